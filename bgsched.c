@@ -0,0 +1,133 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bgsched.h"
+#include "workpool.h"
+
+// most background steps queued or running at once.
+#define BGSCHED_MAX_PENDING 1024
+// most prompt steps queued or running at once.
+#define BGSCHED_PROMPT_PENDING 16
+
+// A background task and its rate limit, kept as a token bucket that
+// holds up to a second of work.
+typedef struct bgsched_task_t {
+  bgsched_step_fn step;
+  bgsched_done_fn done;
+  void *arg;
+  int priority;
+  int rate;        // units of work per second, or 0 for no limit
+  double tokens;   // units of work the task may do right away
+  uint64_t refill; // time the bucket was last refilled
+} bgsched_task_t;
+
+static workpool_t *bgsched_pool = NULL;
+static workpool_t *bgsched_prompt_pool = NULL; // runs BGSCHED_PROMPT tasks
+static int bgsched_stopping = 0;
+
+// Ends the given task.
+static void bgsched_finish(bgsched_task_t *task) {
+  if (NULL != task->done) {
+    task->done(task->arg);
+  }
+  free(task);
+}
+
+static void bgsched_run(void *arg);
+
+// Queues the next step of the given task on the pool for its priority.
+static int bgsched_queue(bgsched_task_t *task, uint64_t when) {
+  if (BGSCHED_PROMPT == task->priority) {
+    return workpool_submit_at(bgsched_prompt_pool, 0, when, bgsched_run, task);
+  }
+  return workpool_submit_at(bgsched_pool, task->priority, when, bgsched_run, task);
+}
+
+// Runs a step of the given task and schedules the next one, delayed
+// until the task has tokens for it again.
+static void bgsched_run(void *arg) {
+  bgsched_task_t *task = arg;
+  if (__atomic_load_n(&bgsched_stopping, __ATOMIC_RELAXED)) {
+    bgsched_finish(task);
+    return;
+  }
+  int units = task->step(task->arg);
+  if (units <= 0) {
+    bgsched_finish(task);
+    return;
+  }
+
+  uint64_t when = 0;
+  if (0 < task->rate) {
+    uint64_t now = workpool_now();
+    task->tokens += (double) (now - task->refill) * task->rate / 1e9;
+    if (task->rate < task->tokens) {
+      task->tokens = task->rate;
+    }
+    task->refill = now;
+    task->tokens -= units;
+    if (task->tokens < 0) {
+      when = now + (uint64_t) (-task->tokens * 1e9 / task->rate);
+    }
+  }
+  if (0 != bgsched_queue(task, when)) {
+    bgsched_finish(task);
+  }
+}
+
+// Starts the background threads.
+void bgsched_init(int threads) {
+  if (NULL != bgsched_pool) {
+    return;
+  }
+  bgsched_stopping = 0;
+  bgsched_pool = workpool_new(threads, BGSCHED_MAX_PENDING, WORKPOOL_BACKGROUND);
+  bgsched_prompt_pool = workpool_new(1, BGSCHED_PROMPT_PENDING, 0);
+  if (NULL == bgsched_pool || NULL == bgsched_prompt_pool) {
+    if (NULL != bgsched_pool) {
+      workpool_free(bgsched_pool);
+    }
+    if (NULL != bgsched_prompt_pool) {
+      workpool_free(bgsched_prompt_pool);
+    }
+    bgsched_pool = NULL;
+    bgsched_prompt_pool = NULL;
+  }
+  printf("+ bgsched_init(%d) -> %s\n", threads, NULL == bgsched_pool ? "failed" : "ok");
+}
+
+// Schedules a background task.
+int bgsched_submit(int priority, int rate, bgsched_step_fn step,
+                   bgsched_done_fn done, void *arg) {
+  if (NULL == bgsched_pool) {
+    return -1;
+  }
+  bgsched_task_t *task = malloc(sizeof(bgsched_task_t));
+  task->step = step;
+  task->done = done;
+  task->arg = arg;
+  task->priority = priority;
+  task->rate = rate;
+  task->tokens = rate;
+  task->refill = workpool_now();
+  if (0 != bgsched_queue(task, 0)) {
+    free(task);
+    return -1;
+  }
+  return 0;
+}
+
+// Stops the background threads, dropping unfinished tasks.
+void bgsched_stop() {
+  if (NULL == bgsched_pool) {
+    return;
+  }
+  // queued and delayed steps still run, but only to end their tasks.
+  __atomic_store_n(&bgsched_stopping, 1, __ATOMIC_RELAXED);
+  workpool_free(bgsched_pool);
+  workpool_free(bgsched_prompt_pool);
+  bgsched_pool = NULL;
+  bgsched_prompt_pool = NULL;
+  printf("+ bgsched_stop()\n");
+}
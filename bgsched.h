@@ -0,0 +1,61 @@
+// Scheduler for background maintenance work.
+#ifndef BGSCHED_H
+#define BGSCHED_H
+
+#define BGSCHED_THREADS 2 // default number of background threads
+
+// Priorities of background tasks; steps of higher priority tasks run first.
+#define BGSCHED_HIGH 0
+#define BGSCHED_NORMAL 1
+#define BGSCHED_LOW 2
+// Runs at normal CPU priority on its own thread rather than at idle
+// priority, for short steps that take locks foreground requests wait on.
+#define BGSCHED_PROMPT 3
+
+/**
+ * A step of a background task. Does a bounded amount of work and
+ * returns how many units of work it did (e.g. blocks), or 0 once the
+ * task is finished.
+ */
+typedef int (*bgsched_step_fn)(void *arg);
+
+/**
+ * Called once when a background task finishes, or is dropped because
+ * the scheduler stopped.
+ */
+typedef void (*bgsched_done_fn)(void *arg);
+
+/**
+ * Starts the background threads. They run with SCHED_IDLE, so they
+ * only take CPU time that foreground requests leave unused, except for
+ * one thread running BGSCHED_PROMPT tasks at normal priority.
+ *
+ * @param threads Number of background threads.
+ */
+void bgsched_init(int threads);
+
+/**
+ * Schedules a background task, which is stepped until it finishes.
+ * Steps of all tasks share the background threads, interleaved by
+ * priority.
+ *
+ * @param priority BGSCHED_HIGH, BGSCHED_NORMAL, BGSCHED_LOW or
+ *        BGSCHED_PROMPT.
+ * @param rate Most units of work per second, or 0 for no limit.
+ * @param step Function doing one step of the task.
+ * @param done Function called when the task ends, or NULL.
+ * @param arg Argument passed to step and done.
+ *
+ * @return 0 on success, -1 if the scheduler is not running; done is
+ *         not called then.
+ */
+int bgsched_submit(int priority, int rate, bgsched_step_fn step,
+                   bgsched_done_fn done, void *arg);
+
+/**
+ * Stops the background threads, waiting for the steps already running
+ * and dropping the rest of every unfinished task.
+ */
+void bgsched_stop(void);
+
+#endif
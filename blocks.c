@@ -10,8 +10,10 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -19,7 +21,10 @@
 
 #include "bitmap.h"
 #include "blocks.h"
+#include "cbt.h"
 #include "inode.h"
+#include "memops.h"
+#include "super.h"
 
 const int BLOCK_COUNT = 256; // we split the "disk" into 256 blocks
 const int BLOCK_SIZE = 4096; // = 4K
@@ -33,6 +38,27 @@ const int INODE_BITMAP_SIZE = INODE_COUNT / 8;
 
 static int blocks_fd = -1;
 static void *blocks_base = 0;
+static size_t blocks_map_size = 0;
+// in-memory bitmap of free blocks known to read as zeros (e.g. punched
+// holes), so allocating them again does not need to clear them.
+static uint8_t *blocks_zero_map = 0;
+
+// A window of consecutive blocks of the image mapped on demand.
+typedef struct blocks_window_t {
+  int first;          // first block in the window, or -1 if unused
+  int pins;           // number of pins keeping the window mapped
+  unsigned long used; // LRU clock value of the last access
+  char *addr;         // start of the mapping
+} blocks_window_t;
+
+// windowed mapping state, used when blocks_window_blocks is nonzero.
+static int blocks_window_blocks = 0;
+static int blocks_window_count = 0;
+static blocks_window_t *blocks_windows = 0;
+static blocks_window_t *blocks_window_last = 0;
+static unsigned long blocks_clock = 0;
+static pthread_mutex_t blocks_window_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t blocks_window_unpinned = PTHREAD_COND_INITIALIZER;
 
 // Get the number of blocks needed to store the given number of bytes.
 int bytes_to_blocks(int bytes) {
@@ -45,19 +71,185 @@ int bytes_to_blocks(int bytes) {
   }
 }
 
+// Maps the disk image file with the base aligned to a huge page, so
+// the kernel can back it with transparent huge pages where supported.
+static void *blocks_map_aligned(int fd, size_t size) {
+  // reserves enough address space to find an aligned start in.
+  size_t span = size + BLOCKS_HUGE_PAGE;
+  char *area = mmap(0, span, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (MAP_FAILED == area) {
+    return MAP_FAILED;
+  }
+  uintptr_t start = ((uintptr_t) area + BLOCKS_HUGE_PAGE - 1) &
+                    ~((uintptr_t) BLOCKS_HUGE_PAGE - 1);
+  char *base = mmap((void *) start, size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_FIXED, fd, 0);
+  if (MAP_FAILED == base) {
+    munmap(area, span);
+    return MAP_FAILED;
+  }
+  // releases the unused reservation on both sides of the mapping.
+  if (base > area) {
+    munmap(area, base - area);
+  }
+  munmap(base + size, area + span - (base + size));
+  if (0 != madvise(base, size, MADV_HUGEPAGE)) {
+    printf("+ blocks_init() -> MADV_HUGEPAGE unsupported (%d)\n", errno);
+  }
+  return base;
+}
+
+// Maps an anonymous in-memory volume, preferring preallocated hugetlb
+// pages and falling back to transparent huge pages.
+static void *blocks_map_memory(size_t size) {
+  void *base = mmap(0, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (MAP_FAILED != base) {
+    return base;
+  }
+  printf("+ blocks_init() -> no hugetlb pages (%d)\n", errno);
+  base = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+              -1, 0);
+  if (MAP_FAILED != base) {
+    madvise(base, size, MADV_HUGEPAGE);
+  }
+  return base;
+}
+
+// Sets up the windowed mapping with the given window size in blocks
+// and the given maximum number of live windows.
+static void blocks_windows_init(int window_blocks, int max_windows) {
+  // the first window must hold block 0 and the whole inode table, since
+  // inodes are addressed as one contiguous array.
+  int meta = 1 + bytes_to_blocks(INODE_COUNT * INODE_SIZE);
+  blocks_window_blocks = window_blocks < meta ? meta : window_blocks;
+  // the permanently pinned windows can not be evicted, so at least two
+  // more are needed for data and indirect blocks.
+  int min_windows = BLOCKS_PERMANENT_PINS + 2;
+  blocks_window_count = max_windows < min_windows ? min_windows : max_windows;
+  blocks_windows = calloc(blocks_window_count, sizeof(blocks_window_t));
+  assert(blocks_windows != NULL);
+  for (int ii = 0; ii < blocks_window_count; ++ii) {
+    blocks_windows[ii].first = -1;
+  }
+  printf("+ blocks_init() -> %d windows of %d blocks\n", blocks_window_count,
+         blocks_window_blocks);
+}
+
+// Unmaps all windows of the windowed mapping.
+static void blocks_windows_free() {
+  for (int ii = 0; ii < blocks_window_count; ++ii) {
+    blocks_window_t *win = &blocks_windows[ii];
+    if (-1 != win->first) {
+      munmap(win->addr, BLOCK_SIZE * blocks_window_blocks);
+    }
+  }
+  free(blocks_windows);
+  blocks_windows = 0;
+  blocks_window_last = 0;
+}
+
+// Gets the live window holding the given block, mapping it in place of
+// the least recently used unpinned window if needed, and waiting for
+// one to be unpinned if all are in use by other threads.
+// NOTE: Assumes blocks_window_lock is held.
+static blocks_window_t *blocks_window_get(int bnum) {
+  int first = bnum - bnum % blocks_window_blocks;
+  blocks_window_t *win = blocks_window_last;
+  while (NULL == win || first != win->first) {
+    // looks for the window among the live ones, remembering the best
+    // one to evict in case it is not mapped.
+    blocks_window_t *victim = NULL;
+    win = NULL;
+    for (int ii = 0; ii < blocks_window_count; ++ii) {
+      blocks_window_t *cand = &blocks_windows[ii];
+      if (first == cand->first) {
+        win = cand;
+        break;
+      }
+      if (0 == cand->pins &&
+          (NULL == victim || -1 == cand->first ||
+           (-1 != victim->first && cand->used < victim->used))) {
+        victim = cand;
+      }
+    }
+    if (NULL == win && NULL == victim) {
+      // every window is pinned for a copy in progress.
+      pthread_cond_wait(&blocks_window_unpinned, &blocks_window_lock);
+      win = blocks_window_last;
+      continue;
+    }
+    if (NULL == win) {
+      if (-1 != victim->first) {
+        munmap(victim->addr, BLOCK_SIZE * blocks_window_blocks);
+      }
+      // the last window may extend past the end of the image, which is
+      // fine as long as those pages are never touched.
+      victim->addr = mmap(0, BLOCK_SIZE * blocks_window_blocks,
+                          PROT_READ | PROT_WRITE, MAP_SHARED, blocks_fd,
+                          (off_t) BLOCK_SIZE * first);
+      assert(victim->addr != MAP_FAILED);
+      victim->first = first;
+      win = victim;
+    }
+    blocks_window_last = win;
+  }
+  win->used = ++blocks_clock;
+  return win;
+}
+
 // Load and initialize the given disk image.
-void blocks_init(const char *image_path) {
-  blocks_fd = open(image_path, O_CREAT | O_RDWR, 0644);
-  assert(blocks_fd != -1);
+void blocks_init(const char *image_path) { blocks_init_opts(image_path, NULL); }
 
-  // make sure the disk image is exactly 1MB
-  int rv = ftruncate(blocks_fd, NUFS_SIZE);
-  assert(rv == 0);
+// Load and initialize the given disk image with the given options.
+void blocks_init_opts(const char *image_path, const blocks_opts_t *opts) {
+  blocks_opts_t none = {0};
+  if (NULL == opts) {
+    opts = &none;
+  }
 
-  // map the image to memory
-  blocks_base =
-      mmap(0, NUFS_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, blocks_fd, 0);
-  assert(blocks_base != MAP_FAILED);
+  if (opts->in_memory) {
+    // the volume lives only in memory, in whole huge pages.
+    blocks_map_size = (NUFS_SIZE + BLOCKS_HUGE_PAGE - 1) &
+                      ~((size_t) BLOCKS_HUGE_PAGE - 1);
+    blocks_base = blocks_map_memory(blocks_map_size);
+    assert(blocks_base != MAP_FAILED);
+  } else {
+    blocks_fd = open(image_path, O_CREAT | O_RDWR, 0644);
+    assert(blocks_fd != -1);
+
+    // make sure the disk image is exactly 1MB, or one whole huge page
+    // with hugepages set, since a huge page can only back a fully mapped
+    // and aligned 2MB range of the file. The blocks past the first 1MB
+    // are never used.
+    blocks_map_size = NUFS_SIZE;
+    if (opts->hugepages && 0 == opts->window_blocks) {
+      blocks_map_size = (NUFS_SIZE + BLOCKS_HUGE_PAGE - 1) &
+                        ~((size_t) BLOCKS_HUGE_PAGE - 1);
+    }
+    int rv = ftruncate(blocks_fd, blocks_map_size);
+    assert(rv == 0);
+
+    // map the image to memory
+    if (0 < opts->window_blocks) {
+      blocks_windows_init(opts->window_blocks, opts->max_windows);
+    } else if (opts->hugepages) {
+      blocks_base = blocks_map_aligned(blocks_fd, blocks_map_size);
+    } else {
+      blocks_base = mmap(0, NUFS_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         blocks_fd, 0);
+    }
+    assert(blocks_windows || blocks_base != MAP_FAILED);
+  }
+
+  blocks_zero_map = calloc(BLOCK_BITMAP_SIZE, 1);
+  assert(blocks_zero_map != NULL);
+
+  // keeps the bitmaps and inode table mapped for good; they share
+  // the first window.
+  if (blocks_windows) {
+    blocks_pin(0);
+  }
 
   // block 0 stores the block bitmap and the inode bitmap
   void *bbm = get_blocks_bitmap();
@@ -66,12 +258,84 @@ void blocks_init(const char *image_path) {
 
 // Close the disk image.
 void blocks_free() {
-  int rv = munmap(blocks_base, NUFS_SIZE);
-  assert(rv == 0);
+  if (blocks_windows) {
+    blocks_windows_free();
+  } else {
+    int rv = munmap(blocks_base, blocks_map_size);
+    assert(rv == 0);
+  }
+  if (-1 != blocks_fd) {
+    close(blocks_fd);
+    blocks_fd = -1;
+  }
+  free(blocks_zero_map);
+  blocks_zero_map = 0;
 }
 
 // Get the given block, returning a pointer to its start.
-void *blocks_get_block(int bnum) { return blocks_base + BLOCK_SIZE * bnum; }
+void *blocks_get_block(int bnum) {
+  if (NULL == blocks_windows) {
+    return blocks_base + BLOCK_SIZE * bnum;
+  }
+  pthread_mutex_lock(&blocks_window_lock);
+  blocks_window_t *win = blocks_window_get(bnum);
+  char *ptr = win->addr + BLOCK_SIZE * (bnum - win->first);
+  pthread_mutex_unlock(&blocks_window_lock);
+  return ptr;
+}
+
+// Flush changes to the disk image.
+void blocks_sync() {
+  if (-1 == blocks_fd) {
+    return;
+  }
+  if (NULL == blocks_windows) {
+    msync(blocks_base, blocks_map_size, MS_SYNC);
+  }
+  // also writes back pages dirtied through evicted windows.
+  fsync(blocks_fd);
+}
+
+// Asks the kernel to start reading the given block into memory.
+void blocks_prefetch(int bnum) {
+  if (NULL != blocks_windows) {
+    // reads ahead into the page cache without mapping a window.
+    readahead(blocks_fd, (off_t) BLOCK_SIZE * bnum, BLOCK_SIZE);
+  } else if (-1 != blocks_fd) {
+    madvise(blocks_base + BLOCK_SIZE * bnum, BLOCK_SIZE, MADV_WILLNEED);
+  }
+}
+
+// Gets the number of blocks starting at the given block that are
+// consecutive in memory.
+int blocks_contiguous(int bnum) {
+  if (NULL == blocks_windows) {
+    return BLOCK_COUNT - bnum;
+  }
+  return blocks_window_blocks - bnum % blocks_window_blocks;
+}
+
+// Keeps the block with the given index mapped until unpinned.
+void blocks_pin(int bnum) {
+  if (NULL == blocks_windows) {
+    return;
+  }
+  pthread_mutex_lock(&blocks_window_lock);
+  ++blocks_window_get(bnum)->pins;
+  pthread_mutex_unlock(&blocks_window_lock);
+}
+
+// Releases a pin taken with blocks_pin.
+void blocks_unpin(int bnum) {
+  if (NULL == blocks_windows) {
+    return;
+  }
+  pthread_mutex_lock(&blocks_window_lock);
+  if (0 == --blocks_window_get(bnum)->pins) {
+    pthread_cond_broadcast(&blocks_window_unpinned);
+  }
+  pthread_mutex_unlock(&blocks_window_lock);
+}
 
 // Return a pointer to the beginning of the block bitmap.
 // The size is BLOCK_BITMAP_SIZE bytes.
@@ -85,13 +349,68 @@ void *get_inode_bitmap() {
   return (void *) (block + BLOCK_BITMAP_SIZE);
 }
 
-// Allocate a new block and return its index.
-int alloc_block() {
+// Checks if the given block is a hole in the disk image, meaning it
+// has no backing data and reads as zeros.
+static int blocks_is_hole(int bnum) {
+  if (-1 == blocks_fd) {
+    return 0;
+  }
+  off_t start = (off_t) BLOCK_SIZE * bnum;
+  off_t data = lseek(blocks_fd, start, SEEK_DATA);
+  // ENXIO means there is no data from start to the end of the image.
+  if (-1 == data) {
+    return ENXIO == errno;
+  }
+  return start + BLOCK_SIZE <= data;
+}
+
+// Makes sure the given block reads as zeros, clearing it only if it
+// is not already known to be zero.
+void blocks_clear(int bnum) {
+  if (bitmap_get(blocks_zero_map, bnum)) {
+    return;
+  }
+  if (blocks_is_hole(bnum)) {
+    return;
+  }
+  memops_zero_stream(blocks_get_block(bnum), BLOCK_SIZE);
+}
+
+// Gets the superblock if the image has been mounted with one, or NULL
+// if only the bitmaps can be trusted.
+static super_t *blocks_super(void) {
+  super_t *sb = get_super();
+  return SUPER_MAGIC == sb->magic ? sb : NULL;
+}
+
+// Allocates the next free block, clearing it if asked to.
+static int blocks_alloc(int clear) {
   void *bbm = get_blocks_bitmap();
+  super_t *sb = blocks_super();
+  if (NULL != sb && sb->free_blocks <= 0) {
+    return -1;
+  }
 
-  for (int ii = 1; ii < BLOCK_COUNT; ++ii) {
+  // searches from where the last allocation left off, or scans the
+  // whole bitmap without a superblock.
+  int start = NULL == sb ? 1 : sb->block_cursor;
+  if (start < 1 || BLOCK_COUNT <= start) {
+    start = 1;
+  }
+  for (int jj = 0; jj < BLOCK_COUNT - 1; ++jj) {
+    int ii = 1 + (start - 1 + jj) % (BLOCK_COUNT - 1);
     if (!bitmap_get(bbm, ii)) {
       bitmap_put(bbm, ii, 1);
+      if (NULL != sb) {
+        --sb->free_blocks;
+        sb->block_cursor = ii + 1;
+      }
+      if (clear) {
+        blocks_clear(ii);
+      }
+      // the block will be written, so it is no longer known to be zero.
+      bitmap_put(blocks_zero_map, ii, 0);
+      cbt_mark(ii);
       printf("+ alloc_block() -> %d\n", ii);
       return ii;
     }
@@ -100,9 +419,37 @@ int alloc_block() {
   return -1;
 }
 
+// Allocate a new block and return its index.
+int alloc_block() { return blocks_alloc(1); }
+
+// Allocate a new block without clearing it and return its index.
+int alloc_block_uninit() { return blocks_alloc(0); }
+
 // Deallocate the block with the given index.
 void free_block(int bnum) {
   printf("+ free_block(%d)\n", bnum);
   void *bbm = get_blocks_bitmap();
+  if (!bitmap_get(bbm, bnum)) {
+    return;
+  }
   bitmap_put(bbm, bnum, 0);
+  super_t *sb = blocks_super();
+  if (NULL != sb) {
+    ++sb->free_blocks;
+  }
+  cbt_mark(bnum);
+  // punches a hole so the block reads as zeros when reused and no
+  // longer takes up space in the image. An in-memory volume is backed by
+  // huge pages, which cannot be released a block at a time, so the block
+  // is cleared instead.
+  int rv = 0;
+  if (-1 == blocks_fd) {
+    memops_zero_stream(blocks_get_block(bnum), BLOCK_SIZE);
+  } else {
+    rv = fallocate(blocks_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                   (off_t) BLOCK_SIZE * bnum, BLOCK_SIZE);
+  }
+  if (0 == rv) {
+    bitmap_put(blocks_zero_map, bnum, 1);
+  }
 }
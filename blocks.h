@@ -17,6 +17,19 @@ extern const int NUFS_SIZE;   // default = 1MB
 
 extern const int BLOCK_BITMAP_SIZE; // default = 256 / 8 = 32
 
+#define BLOCKS_HUGE_PAGE (2 * 1024 * 1024) // 2MB huge page size
+// windows pinned for as long as the image is open: the one holding the
+// bitmaps and inode table, and the one holding the changed block epochs.
+#define BLOCKS_PERMANENT_PINS 2
+
+// Options controlling how the disk image is mapped.
+typedef struct blocks_opts_t {
+  int hugepages; // align the mapping to 2MB and request huge pages
+  int in_memory; // keep the volume in (hugetlb) memory, not the image
+  int window_blocks; // map the image in windows of this many blocks
+  int max_windows;   // maximum number of windows mapped at once
+} blocks_opts_t;
+
 /**
  * Compute the number of blocks needed to store the given number of bytes.
  *
@@ -33,20 +46,90 @@ int bytes_to_blocks(int bytes);
  */
 void blocks_init(const char *image_path);
 
+/**
+ * Load and initialize the given disk image with the given options.
+ *
+ * With hugepages set, the image is grown to BLOCKS_HUGE_PAGE and the
+ * mapping is aligned to it and advised with MADV_HUGEPAGE, so the block
+ * bitmap, inode table and data regions share a huge TLB entry (on file
+ * systems that support huge pages in the page cache, such as tmpfs).
+ *
+ * With in_memory set, the image path is ignored and the volume is kept
+ * in anonymous MAP_HUGETLB memory (or transparent huge pages if no
+ * hugetlb pages are reserved); nothing is persisted.
+ *
+ * With window_blocks set, the image is not mapped as a whole. Instead
+ * windows of window_blocks consecutive blocks are mapped on demand, and
+ * at most max_windows of them are live at once, evicting the least
+ * recently used unpinned window. The first window holds the bitmaps
+ * and the inode table and stays pinned, as does the one holding the
+ * changed block epochs, so max_windows is raised to leave at least two
+ * more for data and indirect blocks.
+ *
+ * @param image_path Path to the disk image file.
+ * @param opts Mapping options, or NULL for the defaults.
+ */
+void blocks_init_opts(const char *image_path, const blocks_opts_t *opts);
+
 /**
  * Close the disk image.
  */
 void blocks_free();
 
+/**
+ * Flush all changes to the disk image to stable storage.
+ */
+void blocks_sync();
+
 /**
  * Get the block with the given index, returning a pointer to its start.
  *
+ * With a windowed mapping the pointer stays valid until the window
+ * holding the block is evicted, which another thread can do at any
+ * time. Pin the block first unless the caller holds the file system
+ * lock exclusively.
+ *
  * @param bnum Block number (index).
  *
  * @return Pointer to the beginning of the block in memory.
  */
 void *blocks_get_block(int bnum);
 
+/**
+ * Ask the kernel to start reading the block with the given index into
+ * memory without waiting for it. Does nothing for in-memory volumes.
+ *
+ * @param bnum Block number (index).
+ */
+void blocks_prefetch(int bnum);
+
+/**
+ * Get the number of blocks starting at the given block that are
+ * consecutive in memory, so they can be accessed through the pointer
+ * to the given block.
+ *
+ * @param bnum Block number (index).
+ *
+ * @return Number of blocks consecutive in memory (at least 1).
+ */
+int blocks_contiguous(int bnum);
+
+/**
+ * Keep the block with the given index mapped until it is unpinned.
+ * Pins nest; does nothing unless the image uses a windowed mapping.
+ * Waits while other threads have every window pinned.
+ *
+ * @param bnum Block number (index).
+ */
+void blocks_pin(int bnum);
+
+/**
+ * Release a pin taken with blocks_pin.
+ *
+ * @param bnum Block number (index).
+ */
+void blocks_unpin(int bnum);
+
 /**
  * Return a pointer to the beginning of the block bitmap.
  *
@@ -61,18 +144,41 @@ void *get_blocks_bitmap();
  */
 void *get_inode_bitmap();
 
+/**
+ * Make sure the block with the given index reads as zeros, clearing
+ * it only if it is not known to be zero already (a punched hole or a
+ * hole in the image).
+ *
+ * @param bnum Block number (index).
+ */
+void blocks_clear(int bnum);
+
 /**
  * Allocate a new block and return its number.
  *
- * Grabs the first unused block and marks it as allocated.
+ * Grabs the next unused block after the one allocated last (the
+ * allocation cursor in the superblock) and marks it as allocated. The
+ * block is guaranteed to read as zeros; blocks known to be zero
+ * (punched holes) are handed out without being cleared again.
  *
  * @return The index of the newly allocated block.
  */
 int alloc_block();
 
+/**
+ * Allocate a new block like alloc_block, but without making sure it
+ * reads as zeros. Only for callers about to overwrite all of it.
+ *
+ * @return The index of the newly allocated block.
+ */
+int alloc_block_uninit();
+
 /**
  * Deallocate the block with the given number.
  *
+ * Punches a hole over the block in the disk image where supported,
+ * so it is known to read as zeros when allocated again.
+ *
  * @param bnun The block number to deallocate.
  */
 void free_block(int bnum);
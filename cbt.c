@@ -0,0 +1,63 @@
+#include <assert.h>
+#include <stdio.h>
+
+#include "bitmap.h"
+#include "blocks.h"
+#include "cbt.h"
+#include "inode.h"
+#include "super.h"
+
+// epochs of the blocks, in the pinned epoch block.
+static uint32_t *cbt = NULL;
+static uint32_t cbt_epoch = 0;
+
+// Gets the epochs from the block recorded in the superblock.
+uint32_t *cbt_epochs(void) {
+  super_t *sb = get_super();
+  if (0 >= sb->cbt_block || BLOCK_COUNT <= sb->cbt_block ||
+      !bitmap_get(get_blocks_bitmap(), sb->cbt_block)) {
+    return NULL;
+  }
+  return (uint32_t *) blocks_get_block(sb->cbt_block);
+}
+
+// Starts a new epoch.
+void cbt_init(int clean) {
+  assert(BLOCK_COUNT * sizeof(uint32_t) <= (size_t) BLOCK_SIZE);
+  super_t *sb = get_super();
+  uint32_t *epochs = cbt_epochs();
+  int all = !clean;
+  if (NULL == epochs) {
+    sb->cbt_block = alloc_block();
+    if (-1 == sb->cbt_block) {
+      // tries again on a later mount.
+      sb->cbt_block = 0;
+      printf("+ cbt_init() -> -1\n");
+      return;
+    }
+    sb->cbt_epoch = 0;
+    all = 1;
+  }
+  cbt_epoch = ++sb->cbt_epoch;
+  // keeps the epoch block mapped, since every write updates it.
+  blocks_pin(sb->cbt_block);
+  cbt = (uint32_t *) blocks_get_block(sb->cbt_block);
+  for (int ii = 0; ii < BLOCK_COUNT; ++ii) {
+    if (all || ii <= inode_table_blocks() || ii == sb->cbt_block) {
+      cbt[ii] = cbt_epoch;
+    }
+  }
+  printf("+ cbt_init() -> epoch %u\n", cbt_epoch);
+}
+
+// Records that a block changed in this epoch.
+void cbt_mark(int bnum) {
+  if (NULL == cbt || bnum <= 0 || BLOCK_COUNT <= bnum) {
+    return;
+  }
+  // skips the store when it would not change anything, as it usually
+  // will not.
+  if (cbt_epoch != cbt[bnum]) {
+    cbt[bnum] = cbt_epoch;
+  }
+}
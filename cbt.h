@@ -0,0 +1,34 @@
+// Changed-block tracking: the epoch in which every block last changed,
+// so incremental backups only copy the blocks changed since the last.
+#ifndef CBT_H
+#define CBT_H
+
+#include <stdint.h>
+
+/**
+ * Starts a new epoch, allocating the block of epochs if the image has
+ * none yet. Every block counts as changed in the first epoch, and in
+ * the epoch after an unclean shutdown, since changes may have been
+ * lost. Block 0, the inode table and the epoch block itself always
+ * count as changed.
+ *
+ * @param clean 1 if the file system was unmounted cleanly.
+ */
+void cbt_init(int clean);
+
+/**
+ * Records that the block with the given index changed in this epoch.
+ *
+ * @param bnum Block number (index).
+ */
+void cbt_mark(int bnum);
+
+/**
+ * Gets the epochs in which the blocks of a mapped image last changed.
+ *
+ * @return Array of BLOCK_COUNT epochs, or NULL if the image does not
+ *         track changed blocks.
+ */
+uint32_t *cbt_epochs(void);
+
+#endif
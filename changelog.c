@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bitmap.h"
+#include "blocks.h"
+#include "cbt.h"
+#include "changelog.h"
+#include "super.h"
+
+#define CHANGELOG_PER_BLOCK ((int) (BLOCK_SIZE / sizeof(nufs_change_t)))
+#define CHANGELOG_CAPACITY (SUPER_CHANGELOG_BLOCKS * CHANGELOG_PER_BLOCK)
+
+// Sequence number past the last change handed out to a consumer, which
+// writes must not be merged into any more.
+static uint64_t changelog_read_mark = 0;
+
+// Gets the block holding the change with the given sequence number and
+// the index of the change in it.
+static int changelog_block(super_t *sb, uint64_t seq, int *idx) {
+  int slot = seq % CHANGELOG_CAPACITY;
+  *idx = slot % CHANGELOG_PER_BLOCK;
+  return sb->changelog_blocks[slot / CHANGELOG_PER_BLOCK];
+}
+
+// Allocates the journal's blocks unless the image already has them.
+void changelog_init(void) {
+  super_t *sb = get_super();
+  void *bbm = get_blocks_bitmap();
+  int valid = 1;
+  for (int ii = 0; ii < SUPER_CHANGELOG_BLOCKS; ++ii) {
+    int bnum = sb->changelog_blocks[ii];
+    valid = valid && 0 < bnum && bnum < BLOCK_COUNT && bitmap_get(bbm, bnum);
+  }
+  if (valid) {
+    // changes from earlier mounts may have been read already.
+    changelog_read_mark = sb->changelog_head;
+    return;
+  }
+  for (int ii = 0; ii < SUPER_CHANGELOG_BLOCKS; ++ii) {
+    int bnum = sb->changelog_blocks[ii];
+    if (0 >= bnum || BLOCK_COUNT <= bnum || !bitmap_get(bbm, bnum)) {
+      sb->changelog_blocks[ii] = alloc_block();
+    }
+    if (-1 == sb->changelog_blocks[ii]) {
+      // gives back the ring blocks taken so far and leaves the journal
+      // off until a later mount finds space.
+      for (int jj = 0; jj < SUPER_CHANGELOG_BLOCKS; ++jj) {
+        if (jj < ii) {
+          free_block(sb->changelog_blocks[jj]);
+        }
+        sb->changelog_blocks[jj] = 0;
+      }
+      printf("+ changelog_init() -> -1\n");
+      return;
+    }
+  }
+  // sequence numbers keep counting up, but older changes are gone.
+  if (0 == sb->changelog_head) {
+    sb->changelog_head = 1;
+  }
+  sb->changelog_tail = sb->changelog_head;
+  changelog_read_mark = sb->changelog_head;
+  printf("+ changelog_init() -> %d changes\n", CHANGELOG_CAPACITY);
+}
+
+// Appends a change, overwriting the oldest one once the ring is full.
+void changelog_add(int op, int inum, int parent, const char *name) {
+  super_t *sb = get_super();
+  if (0 == sb->changelog_blocks[0]) {
+    return;
+  }
+  int idx;
+  int bnum;
+  nufs_change_t *change;
+  // a run of writes to a file is one change, unless a consumer has
+  // already read it and would miss the later writes.
+  uint64_t mark = __atomic_load_n(&changelog_read_mark, __ATOMIC_RELAXED);
+  if (NUFS_CHANGE_WRITE == op && sb->changelog_tail < sb->changelog_head &&
+      mark < sb->changelog_head) {
+    bnum = changelog_block(sb, sb->changelog_head - 1, &idx);
+    blocks_pin(bnum);
+    change = (nufs_change_t *) blocks_get_block(bnum) + idx;
+    int same = NUFS_CHANGE_WRITE == change->op && (uint32_t) inum == change->ino;
+    blocks_unpin(bnum);
+    if (same) {
+      return;
+    }
+  }
+  if ((uint64_t) CHANGELOG_CAPACITY <= sb->changelog_head - sb->changelog_tail) {
+    ++sb->changelog_tail;
+  }
+  bnum = changelog_block(sb, sb->changelog_head, &idx);
+  blocks_pin(bnum);
+  change = (nufs_change_t *) blocks_get_block(bnum) + idx;
+  memset(change, 0, sizeof(nufs_change_t));
+  change->seq = sb->changelog_head;
+  change->op = op;
+  change->ino = inum;
+  change->parent = parent;
+  if (NULL != name) {
+    strncpy(change->name, name, NUFS_NAME_MAX - 1);
+  }
+  blocks_unpin(bnum);
+  cbt_mark(bnum);
+  ++sb->changelog_head;
+}
+
+// Copies changes in order from the given sequence number on.
+int changelog_read(uint64_t cursor, nufs_change_t *changes, int max, uint64_t *first) {
+  super_t *sb = get_super();
+  *first = sb->changelog_tail;
+  if (0 == sb->changelog_blocks[0]) {
+    return 0;
+  }
+  uint64_t seq = cursor < sb->changelog_tail ? sb->changelog_tail : cursor;
+  int count = 0;
+  for (; count < max && seq < sb->changelog_head; ++count, ++seq) {
+    int idx;
+    int bnum = changelog_block(sb, seq, &idx);
+    blocks_pin(bnum);
+    changes[count] = ((nufs_change_t *) blocks_get_block(bnum))[idx];
+    blocks_unpin(bnum);
+  }
+  // readers share the lock, so the mark only ever moves up.
+  uint64_t mark = __atomic_load_n(&changelog_read_mark, __ATOMIC_RELAXED);
+  while (0 < count && mark < seq &&
+         !__atomic_compare_exchange_n(&changelog_read_mark, &mark, seq, 0,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+  return count;
+}
+
+// Drops the changes before the given sequence number.
+void changelog_clear(uint64_t seq) {
+  super_t *sb = get_super();
+  if (sb->changelog_head < seq) {
+    seq = sb->changelog_head;
+  }
+  if (sb->changelog_tail < seq) {
+    sb->changelog_tail = seq;
+  }
+}
@@ -0,0 +1,48 @@
+// Change journal: an append-only ring of changes kept in the image,
+// for consumers that only want to process what changed.
+#ifndef CHANGELOG_H
+#define CHANGELOG_H
+
+#include <stdint.h>
+
+#include "nufs_ioctl.h"
+
+/**
+ * Allocates the journal's blocks if the image has none yet. Without
+ * them, changes are not recorded.
+ */
+void changelog_init(void);
+
+/**
+ * Appends a change to the journal, overwriting the oldest one if it is
+ * full. A write right after a write to the same inode is not recorded
+ * again, unless changelog_read has handed out the earlier one.
+ *
+ * @param op Kind of change, NUFS_CHANGE_*.
+ * @param inum Inode changed.
+ * @param parent Directory of the name.
+ * @param name Name in the directory, or NULL.
+ */
+void changelog_add(int op, int inum, int parent, const char *name);
+
+/**
+ * Copies changes from the journal in order, starting at the given
+ * sequence number or the oldest one kept, whichever is later.
+ *
+ * @param cursor Sequence number to start at.
+ * @param changes Buffer for the changes.
+ * @param max Number of changes the buffer holds.
+ * @param first Set to the sequence number of the oldest change kept.
+ *
+ * @return Number of changes copied.
+ */
+int changelog_read(uint64_t cursor, nufs_change_t *changes, int max, uint64_t *first);
+
+/**
+ * Drops the changes before the given sequence number.
+ *
+ * @param seq Sequence number of the first change to keep.
+ */
+void changelog_clear(uint64_t seq);
+
+#endif
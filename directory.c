@@ -1,28 +1,114 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DIRECTORY_X86 1
+#endif
+
 #include "directory.h"
 #include "bitmap.h"
 #include "blocks.h"
 #include "inode.h"
+#include "super.h"
+#include "usage.h"
 
 const int DIRENT_SIZE = sizeof(dirent_t);
 const int DIR_ROOT = 1;
 
+// A Bloom filter of the names in a directory.
+// NOTE: Relies on callers not changing a directory while looking up
+//       names in it; concurrent lookups may build the filter.
+typedef struct dir_bloom_t {
+  int ready;   // whether the filter holds every name in the directory
+  int nbits;   // size of the filter in bits, a power of two
+  int names;   // names added since the filter was built
+  int deletes; // names deleted since, which stay in the filter
+  uint64_t *bits;
+} dir_bloom_t;
+
+// Finds the dirents among up to 64 (a block) that may have the given
+// name hash: those with a matching hash and those with no hash stored.
+// Returns a bit mask of them.
+typedef uint64_t (*dirent_match_t)(const dirent_t *ents, int count, uint32_t hash);
+
+// Finds the dirents that may have the given name hash, one at a time.
+static uint64_t dirent_match_scalar(const dirent_t *ents, int count, uint32_t hash) {
+  uint64_t mask = 0;
+  for (int ii = 0; ii < count; ++ii) {
+    if (hash == ents[ii].hash || (ents[ii].hash ^ DIRENT_HASH_TAG) != ents[ii].hash_tag) {
+      mask |= 1ull << ii;
+    }
+  }
+  return mask;
+}
+
+#ifdef DIRECTORY_X86
+// Finds the dirents that may have the given name hash, gathering the
+// hashes of 8 dirents at a time.
+__attribute__((target("avx2")))
+static uint64_t dirent_match_avx2(const dirent_t *ents, int count, uint32_t hash) {
+  // dirents are 16 ints apart.
+  const __m256i idx = _mm256_setr_epi32(0, 16, 32, 48, 64, 80, 96, 112);
+  const __m256i want = _mm256_set1_epi32(hash);
+  const __m256i tag = _mm256_set1_epi32(DIRENT_HASH_TAG);
+  uint64_t mask = 0;
+  int ii = 0;
+  for (; ii + 8 <= count; ii += 8) {
+    const char *base = (const char *) &ents[ii];
+    __m256i hashes = _mm256_i32gather_epi32((const int *) (base + offsetof(dirent_t, hash)), idx, 4);
+    __m256i tags = _mm256_i32gather_epi32((const int *) (base + offsetof(dirent_t, hash_tag)), idx, 4);
+    __m256i match = _mm256_cmpeq_epi32(hashes, want);
+    __m256i tagged = _mm256_cmpeq_epi32(_mm256_xor_si256(hashes, tag), tags);
+    // candidates match, or have no hash (andnot flips the tagged lanes).
+    __m256i cand = _mm256_or_si256(match, _mm256_andnot_si256(tagged, _mm256_set1_epi32(-1)));
+    mask |= (uint64_t) _mm256_movemask_ps(_mm256_castsi256_ps(cand)) << ii;
+  }
+  if (ii < count) {
+    mask |= dirent_match_scalar(ents + ii, count - ii, hash) << ii;
+  }
+  return mask;
+}
+#endif
+
+// name hash scan, chosen in directory_init.
+static dirent_match_t dirent_match = dirent_match_scalar;
+
+// serializes building filters.
+static pthread_mutex_t dir_bloom_lock = PTHREAD_MUTEX_INITIALIZER;
+// filters of directories, by inode number, allocated on first lookup.
+static dir_bloom_t *dir_blooms = NULL;
+
+static void directory_set_parents(void);
+
 // Verifies the root directory and Initalizes it if it doesn't exist
 void directory_init() {
+#ifdef DIRECTORY_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    dirent_match = dirent_match_avx2;
+  }
+#endif
   // Checks if root directory already exists
   void *ibm = get_inode_bitmap();
+  inode_table_init(DIR_ROOT);
   inode_t *node = get_inode(DIR_ROOT);
   int isdir = 0;
   read_mode(node->mode, &isdir, NULL, NULL, NULL, NULL);
-  if (bitmap_get(ibm, DIR_ROOT) && isdir) {
-    return;
+  if (!bitmap_get(ibm, DIR_ROOT) || !isdir) {
+    // Initializes root directory (force overrides inode 1).
+    bitmap_put(ibm, DIR_ROOT, 1);
+    node->inum = DIR_ROOT;
+    node->mode = 040755; // mode for a directory
+  }
+  // an image from before parent pointers has them filled in once.
+  super_t *sb = get_super();
+  if (sb->parents_unset) {
+    directory_set_parents();
+    sb->parents_unset = 0;
   }
-
-  // Initializes root directory (force overrides inode 1).
-  bitmap_put(ibm, DIR_ROOT, 1);
-  node->inum = DIR_ROOT;
-  node->mode = 040755; // mode for a directory
 }
 
 // Copies in the dirent with the dirent at the given index.
@@ -36,52 +122,218 @@ int dirent_read(inode_t *di, dirent_t *dirent, int idx) {
   return 0;
 }
 
+// Starts a read-only scan of the given directory at the given dirent.
+void dirent_iter_start(dirent_iter_t *it, inode_t *di, int idx) {
+  it->di = di;
+  it->next = idx < 0 ? 0 : idx;
+  it->pinned = -1;
+}
+
+// Gets the dirents from the next one to the end of its block, pointing
+// straight into the mapped block, which stays pinned until the next
+// call. Returns NULL at the end of the directory.
+const dirent_t *dirent_iter_next(dirent_iter_t *it, int *idx, int *count) {
+  dirent_iter_stop(it);
+  int total = it->di->size / DIRENT_SIZE;
+  if (total <= it->next) {
+    return NULL;
+  }
+  int file_byte = it->next * DIRENT_SIZE;
+  int bnum = inode_find_bnum(it->di, file_byte / BLOCK_SIZE);
+  if (0 == bnum) {
+    return NULL;
+  }
+  // pins the block before getting its address, so a windowed mapping
+  // can not move it while the caller reads.
+  blocks_pin(bnum);
+  it->pinned = bnum;
+  const char *block = blocks_get_block(bnum);
+  int in_block = (BLOCK_SIZE - file_byte % BLOCK_SIZE) / DIRENT_SIZE;
+  *idx = it->next;
+  *count = total - it->next < in_block ? total - it->next : in_block;
+  it->next += *count;
+  return (const dirent_t *) (block + file_byte % BLOCK_SIZE);
+}
+
+// Ends a scan, releasing the block it has pinned.
+void dirent_iter_stop(dirent_iter_t *it) {
+  if (-1 != it->pinned) {
+    blocks_unpin(it->pinned);
+    it->pinned = -1;
+  }
+}
+
+// Hashes a directory entry name (64 bit FNV-1a).
+uint64_t directory_name_hash(const char *name) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (int ii = 0; ii < DIR_NAME_LENGTH && '\0' != name[ii]; ++ii) {
+    hash ^= (unsigned char) name[ii];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// Sets the bits of the given name hash in a filter.
+static void dir_bloom_add(dir_bloom_t *bloom, uint64_t hash) {
+  uint32_t h1 = hash;
+  uint32_t h2 = (hash >> 32) | 1;
+  for (int ii = 0; ii < DIR_BLOOM_PROBES; ++ii) {
+    uint32_t bit = (h1 + ii * h2) & (bloom->nbits - 1);
+    bloom->bits[bit / 64] |= 1ull << (bit % 64);
+  }
+  ++bloom->names;
+}
+
+// Checks if the given name hash may be in a filter.
+static int dir_bloom_test(dir_bloom_t *bloom, uint64_t hash) {
+  uint32_t h1 = hash;
+  uint32_t h2 = (hash >> 32) | 1;
+  for (int ii = 0; ii < DIR_BLOOM_PROBES; ++ii) {
+    uint32_t bit = (h1 + ii * h2) & (bloom->nbits - 1);
+    if (0 == (bloom->bits[bit / 64] & (1ull << (bit % 64)))) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Gets the filter of the given directory, or NULL if it has none.
+static dir_bloom_t *dir_bloom_get(inode_t *di) {
+  if (NULL == dir_blooms || di->inum <= 0 || INODE_COUNT <= di->inum) {
+    return NULL;
+  }
+  return &dir_blooms[di->inum];
+}
+
+// Drops the filter of the given directory, to be rebuilt on the next
+// lookup.
+// NOTE: Only called while no lookups run in the directory.
+static void dir_bloom_reset(int inum) {
+  if (NULL != dir_blooms && 0 < inum && inum < INODE_COUNT) {
+    __atomic_store_n(&dir_blooms[inum].ready, 0, __ATOMIC_RELAXED);
+  }
+}
+
+// Gets the filter of the given directory, building it from the names
+// in the directory if needed. Returns NULL if there is no memory.
+static dir_bloom_t *dir_bloom_build(inode_t *di) {
+  pthread_mutex_lock(&dir_bloom_lock);
+  if (NULL == dir_blooms) {
+    dir_blooms = calloc(INODE_COUNT, sizeof(dir_bloom_t));
+  }
+  dir_bloom_t *bloom = dir_bloom_get(di);
+  if (NULL != bloom && !__atomic_load_n(&bloom->ready, __ATOMIC_RELAXED)) {
+    // sizes the filter for the directory with room to grow.
+    int count = di->size / DIRENT_SIZE;
+    int nbits = DIR_BLOOM_MIN_BITS;
+    while (nbits < DIR_BLOOM_BITS_PER_NAME * count) {
+      nbits *= 2;
+    }
+    if (nbits != bloom->nbits) {
+      free(bloom->bits);
+      bloom->bits = malloc(nbits / 8);
+      bloom->nbits = NULL == bloom->bits ? 0 : nbits;
+    }
+    if (NULL != bloom->bits) {
+      memset(bloom->bits, 0, nbits / 8);
+      bloom->names = 0;
+      bloom->deletes = 0;
+      dirent_iter_t it;
+      const dirent_t *ents;
+      int idx, n;
+      dirent_iter_start(&it, di, 0);
+      while (NULL != (ents = dirent_iter_next(&it, &idx, &n))) {
+        for (int ii = 0; ii < n; ++ii) {
+          if (0 != ents[ii].inum) {
+            dir_bloom_add(bloom, directory_name_hash(ents[ii].name));
+          }
+        }
+      }
+      dirent_iter_stop(&it);
+      __atomic_store_n(&bloom->ready, 1, __ATOMIC_RELEASE);
+    }
+  }
+  pthread_mutex_unlock(&dir_bloom_lock);
+  return NULL == bloom || !bloom->ready ? NULL : bloom;
+}
+
 // Gets the index of the dirent with the given name, or -1 if
-// a dirent with that name does not exist.
+// a dirent with that name does not exist, and sets inum to its inode
+// number unless inum is NULL.
 // NOTE: Assumes the given inode represents a directory.
-int dirent_lookup(inode_t *di, const char *name) {
-  // searches and reads entire file for dirents.
-  for (int ii = 0; ii < di->size / DIRENT_SIZE; ++ii) {
-    dirent_t dirent;
-    dirent_read(di, &dirent, ii);
-    if (strcmp(name, dirent.name) == 0) {
-      return ii;
+static int dirent_find(inode_t *di, const char *name, int *inum) {
+  // skips the search if the name is not in the directory's filter.
+  dir_bloom_t *bloom = dir_bloom_get(di);
+  if (NULL == bloom || !__atomic_load_n(&bloom->ready, __ATOMIC_ACQUIRE)) {
+    bloom = dir_bloom_build(di);
+  }
+  uint64_t hash = directory_name_hash(name);
+  if (NULL != bloom && !dir_bloom_test(bloom, hash)) {
+    return -1;
+  }
+  // searches the entire file a block at a time, in place, only
+  // comparing the names of dirents whose stored hash matches.
+  dirent_iter_t it;
+  const dirent_t *ents;
+  int idx, n;
+  int found = -1;
+  dirent_iter_start(&it, di, 0);
+  while (-1 == found && NULL != (ents = dirent_iter_next(&it, &idx, &n))) {
+    uint64_t mask = dirent_match(ents, n, (uint32_t) hash);
+    while (0 != mask) {
+      int jj = __builtin_ctzll(mask);
+      mask &= mask - 1;
+      if (strncmp(name, ents[jj].name, DIR_NAME_LENGTH) == 0) {
+        found = idx + jj;
+        if (NULL != inum) {
+          *inum = ents[jj].inum;
+        }
+        break;
+      }
     }
   }
-  return -1;
+  dirent_iter_stop(&it);
+  return found;
+}
+
+// Gets the index of the dirent with the given name, or -1 if
+// a dirent with that name does not exist.
+// NOTE: Assumes the given inode represents a directory.
+int dirent_lookup(inode_t *di, const char *name) {
+  return dirent_find(di, name, NULL);
 }
 
 // Gets the inode number of the directory entry with the given
 // name in the given directory.
 int directory_lookup(inode_t *di, const char *name) {
-  int idx = dirent_lookup(di, name);
-  if (idx < 0) {
+  int inum;
+  if (dirent_find(di, name, &inum) < 0) {
     return -1;
   }
-  // reads the information of the found dirent.
-  dirent_t dirent;
-  if (0 != dirent_read(di, &dirent, idx)) {
-    return -1;
-  }
-  return dirent.inum;
+  return inum;
 }
 
 // reads the dnumth directory entry into the given dirent struct.
-// returns -1 if dnum out of range (dirent is last in this case)
+// returns -1 if dnum out of range.
 int directory_read(inode_t *di, dirent_t *dirent, int dnum) {
   int count = -1;
-  dirent_t temp;
-  // searches entire directory file.
-  for (int ii = 0; count < dnum && ii < di->size / DIRENT_SIZE; ++ii) {
-    // checks if directory entry is not empty.
-    if (0 == dirent_read(di, &temp, ii) && 0 != temp.inum) {
-      ++count;
+  dirent_iter_t it;
+  const dirent_t *ents;
+  int idx, n;
+  // searches entire directory file, copying only the target entry.
+  dirent_iter_start(&it, di, 0);
+  while (count < dnum && NULL != (ents = dirent_iter_next(&it, &idx, &n))) {
+    for (int ii = 0; ii < n; ++ii) {
+      // checks if directory entry is not empty.
+      if (0 != ents[ii].inum && ++count == dnum) {
+        if (NULL != dirent) {
+          memcpy(dirent, &ents[ii], DIRENT_SIZE);
+        }
+        break;
+      }
     }
   }
-  // copies temp into the given dirent struct.
-  if (NULL != dirent) {
-    memcpy(dirent, &temp, DIRENT_SIZE);
-  }
+  dirent_iter_stop(&it);
   // checks if target dirent was reached.
   return count >= dnum ? 0 : -1;
 }
@@ -94,19 +346,44 @@ int directory_put(inode_t *di, const char *name, int inum) {
   }
   // finds the next empty directory entry in the directory.
   int offset = di->size;
-  dirent_t dirent;
-  for (int ii = 0; ii < di->size / DIRENT_SIZE; ii++) {
-    dirent_read(di, &dirent, ii);
-    if (dirent.inum == 0) {
-      offset = ii * sizeof(dirent_t);
-      break;
+  dirent_iter_t it;
+  const dirent_t *ents;
+  int idx, n;
+  dirent_iter_start(&it, di, 0);
+  while (offset == di->size && NULL != (ents = dirent_iter_next(&it, &idx, &n))) {
+    for (int ii = 0; ii < n; ++ii) {
+      if (ents[ii].inum == 0) {
+        offset = (idx + ii) * DIRENT_SIZE;
+        break;
+      }
     }
   }
+  dirent_iter_stop(&it);
   // write a new directroy entry to the directory.
+  dirent_t dirent;
+  memset(&dirent, 0, sizeof(dirent));
   memcpy(&dirent.name, name, DIR_NAME_LENGTH);
   dirent.inum = inum;
-  inode_write(di, (char *) &dirent, offset, DIRENT_SIZE);
+  dirent.hash = directory_name_hash(dirent.name);
+  dirent.hash_tag = dirent.hash ^ DIRENT_HASH_TAG;
+  if (DIRENT_SIZE != inode_write(di, (char *) &dirent, offset, DIRENT_SIZE)) {
+    return -1;
+  }
   ++node->links;
+  // a renamed or hard linked inode moves its usage to the new parent.
+  usage_detach(node);
+  node->parent = di->inum;
+  node->parent_slot = offset / DIRENT_SIZE;
+  usage_attach(node);
+  // adds the name to the filter, or has it rebuilt larger once full.
+  dir_bloom_t *bloom = dir_bloom_get(di);
+  if (NULL != bloom && bloom->ready) {
+    if (bloom->nbits / DIR_BLOOM_BITS_PER_NAME <= bloom->names) {
+      dir_bloom_reset(di->inum);
+    } else {
+      dir_bloom_add(bloom, directory_name_hash(dirent.name));
+    }
+  }
   return 0;
 }
 
@@ -131,47 +408,136 @@ int directory_delete(inode_t *di, const char *name) {
   if (!inode_valid(node)) {
     return -1;
   }
+  // forgets the parent if this was the entry it points to. Another
+  // hard link may remain, but finding it would take a tree walk.
+  if (node->parent == di->inum && node->parent_slot == idx) {
+    usage_detach(node);
+    node->parent = 0;
+    node->parent_slot = 0;
+  }
   // checks if inode can be freed or not.
   if (--(get_inode(inum)->links) <= 0) {
     free_inode(inum);
+    // a freed directory's names are gone.
+    dir_bloom_reset(inum);
+  }
+  // deleted names stay in the filter; rebuilds it once they make up
+  // half of it.
+  dir_bloom_t *bloom = dir_bloom_get(di);
+  if (NULL != bloom && bloom->ready && bloom->names <= 2 * ++bloom->deletes) {
+    dir_bloom_reset(di->inum);
   }
   // deletes the directory entry.
   dirent.inum = 0;
   memset(dirent.name, 0, DIR_NAME_LENGTH);
+  dirent.hash = 0;
+  dirent.hash_tag = 0;
   inode_write(di, (char *) &dirent, idx * DIRENT_SIZE, DIRENT_SIZE);
   return 0;
 }
 
+// Directories waiting to have their entries' parent pointers set.
+typedef struct dir_queue_t {
+  int *inums; // each directory is queued once, so INODE_COUNT is enough
+  int head;   // index of the directory being scanned
+  int tail;   // index to queue the next directory at
+} dir_queue_t;
+
+// Sets the parent pointer of an entry that has none yet, queueing it
+// if it is a directory to be scanned in turn.
+static int directory_set_parent(const dirent_t *dirent, int next, void *ctx) {
+  dir_queue_t *queue = ctx;
+  inode_t *node = get_inode(dirent->inum);
+  if (!inode_valid(node) || DIR_ROOT == node->inum || 0 != node->parent) {
+    return 0;
+  }
+  node->parent = queue->inums[queue->head];
+  node->parent_slot = next - 1;
+  int isdir = 0;
+  read_mode(node->mode, &isdir, NULL, NULL, NULL, NULL);
+  if (isdir) {
+    queue->inums[queue->tail++] = node->inum;
+  }
+  return 0;
+}
+
+// Sets the parent pointers of everything reachable from the root,
+// breadth first so only one directory block is pinned at a time.
+static void directory_set_parents(void) {
+  dir_queue_t queue = {calloc(INODE_COUNT, sizeof(int)), 0, 0};
+  queue.inums[queue.tail++] = DIR_ROOT;
+  for (; queue.head < queue.tail; ++queue.head) {
+    directory_iterate(get_inode(queue.inums[queue.head]), 0,
+                      directory_set_parent, &queue);
+  }
+  free(queue.inums);
+  printf("+ directory_set_parents() -> %d directories\n", queue.tail);
+}
+
+// Calls the given function with every nonempty entry of a directory
+// from the given cursor on, reading the entries in place. Returns the
+// cursor of the entry the function stopped at, or -1 if it saw them all.
+int directory_iterate(inode_t *di, int cursor, directory_iterate_fn fn, void *ctx) {
+  int stopped = -1;
+  dirent_iter_t it;
+  const dirent_t *ents;
+  int idx, n;
+  dirent_iter_start(&it, di, cursor);
+  while (-1 == stopped && NULL != (ents = dirent_iter_next(&it, &idx, &n))) {
+    for (int ii = 0; ii < n; ++ii) {
+      if (0 != ents[ii].inum && 0 != fn(&ents[ii], idx + ii + 1, ctx)) {
+        stopped = idx + ii;
+        break;
+      }
+    }
+  }
+  dirent_iter_stop(&it);
+  return stopped;
+}
+
+// Adds an entry's name to the front of a list.
+static int directory_list_entry(const dirent_t *dirent, int next, void *ctx) {
+  (void) next;
+  slist_t **entries = ctx;
+  char name[DIR_NAME_LENGTH + 1];
+  memcpy(name, dirent->name, DIR_NAME_LENGTH);
+  name[DIR_NAME_LENGTH] = '\0';
+  *entries = slist_cons(name, *entries);
+  return 0;
+}
+
 // Returns a list of the directory entries in the given directory.
 slist_t *directory_list(inode_t *di) {
+  if (NULL == di) {
+    return NULL;
+  }
   int isdir = 0;
   read_mode(di->mode, &isdir, NULL, NULL, NULL, NULL);
-  if (NULL == di || isdir) {
+  if (!isdir) {
     return NULL;
   }
   slist_t *entries = NULL;
-  // searches directory file for nonempty directory entries.
-  for (int ii = 0; ii < di->size / DIRENT_SIZE; ii++) {
-    dirent_t dirent;
-    inode_read(di, (char *) &dirent, ii * DIRENT_SIZE, DIRENT_SIZE);
-    if (dirent.inum != 0) {
-      entries = slist_cons(dirent.name, entries);
-    }
-  }
+  directory_iterate(di, 0, directory_list_entry, &entries);
   // reverses the list since list is constructed in reverse.
   entries = slist_reverse(entries);
   return entries;
 }
 
+// Prints the name of an entry.
+static int print_directory_entry(const dirent_t *dirent, int next, void *ctx) {
+  (void) next;
+  (void) ctx;
+  printf("  %.*s\n", DIR_NAME_LENGTH, dirent->name);
+  return 0;
+}
+
 // Prints information about the given directory.
 // NOTE: Assumes dd is a directory.
 void print_directory(inode_t *dd) {
   print_inode(dd);
-  slist_t *entries = directory_list(dd);
   printf("entries:\n");
-  while (NULL != entries) {
-    printf("  %s\n", entries->data);
-    entries = entries->next;
+  if (inode_valid(dd)) {
+    directory_iterate(dd, 0, print_directory_entry, NULL);
   }
 }
 
@@ -201,3 +567,66 @@ inode_t *path_get_inode(const char *path) {
   slist_free(list);
   return di;
 }
+
+// Copies the name of the given directory's entry for the given inode,
+// trying the slot hint before scanning. Returns 0, or -1 if there is none.
+static int dirent_name_of(inode_t *di, int inum, int hint, char *name) {
+  int found = -1;
+  dirent_iter_t it;
+  const dirent_t *ents;
+  int idx, n;
+  dirent_iter_start(&it, di, hint);
+  ents = dirent_iter_next(&it, &idx, &n);
+  if (NULL != ents && ents[0].inum == inum) {
+    memcpy(name, ents[0].name, DIR_NAME_LENGTH);
+    found = 0;
+  }
+  dirent_iter_stop(&it);
+  // the hint is stale; falls back to scanning the whole directory.
+  dirent_iter_start(&it, di, 0);
+  while (-1 == found && NULL != (ents = dirent_iter_next(&it, &idx, &n))) {
+    for (int ii = 0; ii < n; ++ii) {
+      if (ents[ii].inum == inum) {
+        memcpy(name, ents[ii].name, DIR_NAME_LENGTH);
+        found = 0;
+        break;
+      }
+    }
+  }
+  dirent_iter_stop(&it);
+  name[DIR_NAME_LENGTH] = '\0';
+  return found;
+}
+
+// Builds the path of the given inode backwards, following its parent
+// pointers up to the root.
+int directory_path(int inum, char *path, int size) {
+  inode_t *node = get_inode(inum);
+  if (!inode_valid(node) || size < 2) {
+    return -1;
+  }
+  char name[DIR_NAME_LENGTH + 1];
+  int off = size - 1;
+  path[off] = '\0';
+  // a directory cycle in a corrupt image must not loop forever.
+  for (int depth = 0; DIR_ROOT != node->inum; ++depth) {
+    inode_t *di = get_inode(node->parent);
+    if (INODE_COUNT <= depth || !inode_valid(di) ||
+        -1 == dirent_name_of(di, node->inum, node->parent_slot, name)) {
+      return -1;
+    }
+    int len = strlen(name);
+    if (off < len + 1) {
+      return -1;
+    }
+    off -= len;
+    memcpy(path + off, name, len);
+    path[--off] = '/';
+    node = di;
+  }
+  if (size - 1 == off) {
+    path[--off] = '/';
+  }
+  memmove(path, path + off, size - off);
+  return size - 1 - off;
+}
@@ -9,6 +9,18 @@
 // Maximum length of a directory entry name.
 #define DIR_NAME_LENGTH 48
 
+// Bloom filters of directory entry names, kept in memory to answer
+// lookups of missing names without scanning the directory.
+#define DIR_BLOOM_MIN_BITS 1024 // smallest filter size in bits
+#define DIR_BLOOM_BITS_PER_NAME 16 // bits per entry when sizing a filter
+#define DIR_BLOOM_PROBES 4 // bits set per name
+
+// Marks a dirent's name hash as set: hash_tag is hash ^ DIRENT_HASH_TAG.
+// Entries written before name hashes were stored lack it.
+#define DIRENT_HASH_TAG 0x4e484153u
+
+#include <stdint.h>
+
 #include "blocks.h"
 #include "inode.h"
 #include "slist.h"
@@ -19,18 +31,69 @@ extern const int DIR_ROOT;    // Inode number of root directory.
 typedef struct dirent_t {
   char name[DIR_NAME_LENGTH];
   int inum;
-  char _reserved[12];
+  uint32_t hash;     // low 32 bits of directory_name_hash of the name
+  uint32_t hash_tag; // hash ^ DIRENT_HASH_TAG if hash is set
+  char _reserved[4];
 } dirent_t;
 
+// A read-only scan over the dirents of a directory, a block at a time.
+typedef struct dirent_iter_t {
+  inode_t *di;
+  int next;   // index of the next dirent to hand out
+  int pinned; // block pinned for the dirents handed out last, or -1
+} dirent_iter_t;
+
 /**
  * Verifies the root directory and Initalizes it if it doesn't exist.
+ * Also selects the fastest name hash scan the CPU supports.
  */
 void directory_init();
 
+/**
+ * Starts a read-only scan of the given directory. The directory must
+ * not change until the scan is stopped.
+ *
+ * @param it Iterator to start.
+ * @param di Inode of the directory.
+ * @param idx Index of the first dirent to hand out.
+ */
+void dirent_iter_start(dirent_iter_t *it, inode_t *di, int idx);
+
+/**
+ * Gets the next dirents of a scan, up to the end of their block,
+ * without copying them: the pointer is into the mapped directory
+ * block, which stays mapped until the next call or the scan stops.
+ *
+ * @param it Iterator of the scan.
+ * @param idx Set to the index of the first dirent handed out.
+ * @param count Set to the number of dirents handed out.
+ *
+ * @return Pointer to the first dirent, or NULL at the end.
+ */
+const dirent_t *dirent_iter_next(dirent_iter_t *it, int *idx, int *count);
+
+/**
+ * Stops a scan, releasing the block it holds. Safe to call again.
+ *
+ * @param it Iterator of the scan.
+ */
+void dirent_iter_stop(dirent_iter_t *it);
+
+/**
+ * Hashes a directory entry name (64 bit FNV-1a), reading at most
+ * DIR_NAME_LENGTH bytes.
+ *
+ * @param name Entry name.
+ *
+ * @return Hash of the name.
+ */
+uint64_t directory_name_hash(const char *name);
+
 /**
  * Gets the inode number of the directory entry with the given
  * name in the given directory. Returns -1 if such an entry
- * does not exist.
+ * does not exist. Names the directory's Bloom filter rules out are
+ * not searched for; the filter is built on the first lookup.
  *
  * @param di Inode of the directory.
  * @param name Name of entry to look for.
@@ -74,13 +137,44 @@ int directory_put(inode_t *di, const char *name, int inum);
  */
 int directory_delete(inode_t *di, const char *name);
 
+/**
+ * Called by directory_iterate with a nonempty directory entry, which
+ * points into the mapped directory block; the name is not terminated
+ * if it takes up all DIR_NAME_LENGTH bytes.
+ *
+ * @param dirent The entry.
+ * @param next Cursor to resume iterating from after this entry.
+ * @param ctx Context given to directory_iterate.
+ *
+ * @return 0 to go on, or nonzero to stop at this entry.
+ */
+typedef int (*directory_iterate_fn)(const dirent_t *dirent, int next, void *ctx);
+
+/**
+ * Calls the given function with each nonempty entry of the given
+ * directory, in order, from the given cursor on. Entries are read in
+ * place, so listing a directory takes no memory per entry. The
+ * directory must not change until this returns.
+ *
+ * @param di Inode of the directory.
+ * @param cursor 0 to start at the first entry, or a cursor passed to
+ *        the function or returned by an earlier call to resume from.
+ * @param fn Function to call with each entry.
+ * @param ctx Context passed to the function.
+ *
+ * @return Cursor of the entry the function stopped at, to resume
+ *         from, or -1 if every entry was visited.
+ */
+int directory_iterate(inode_t *di, int cursor, directory_iterate_fn fn, void *ctx);
+
 /**
  * Lists the names of all the nonempty directory entries
  * in the given directory.
  *
  * @param di Inode of the directory.
  *
- * @return List of names of directory entries in directory.
+ * @return List of names of directory entries in directory, or NULL
+ *         if it is empty or not a directory.
  */
 slist_t *directory_list(inode_t *di);
 
@@ -116,4 +210,18 @@ void print_directory(inode_t *dd);
  */
 inode_t *path_get_inode(const char *path);
 
+/**
+ * Gets the path of the given inode from the parent pointers of it and
+ * the directories above it, without walking the tree. Of several hard
+ * links, the one made last is found, unless it has been removed.
+ *
+ * @param inum Inode number (index).
+ * @param path Buffer to write the path to.
+ * @param size Size of the buffer.
+ *
+ * @return Length of the path, or -1 if it is not known or the buffer
+ *         is too small.
+ */
+int directory_path(int inum, char *path, int size);
+
 #endif
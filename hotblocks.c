@@ -0,0 +1,153 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bgsched.h"
+#include "blocks.h"
+#include "hotblocks.h"
+
+// sampled access counts, one per block.
+static unsigned int *hotblocks_counts = NULL;
+// state of the calling thread's sampling generator, so sampling does
+// not bounce a shared counter between CPUs.
+static __thread uint32_t hotblocks_seed = 0;
+static char *hotblocks_path = NULL;
+
+// A list of blocks being prefetched by a group of background tasks.
+typedef struct hotblocks_job_t {
+  int *bnums;  // blocks in priority order
+  int count;   // number of blocks
+  int next;    // index of the next block to prefetch
+  int running; // number of tasks still running
+} hotblocks_job_t;
+
+// Starts tracking block accesses for the given disk image.
+void hotblocks_init(const char *image_path) {
+  hotblocks_counts = calloc(BLOCK_COUNT, sizeof(unsigned int));
+  hotblocks_path = malloc(strlen(image_path) + sizeof(".hot"));
+  strcpy(hotblocks_path, image_path);
+  strcat(hotblocks_path, ".hot");
+}
+
+// Counts a sampled access to the given block.
+// NOTE: Counts are approximate; concurrent updates may be lost.
+void hotblocks_touch(int bnum) {
+  if (NULL == hotblocks_counts) {
+    return;
+  }
+  // samples at random rather than every nth access, which would always
+  // pick the same block of accesses that come in a regular pattern.
+  uint32_t x = hotblocks_seed;
+  if (0 == x) {
+    x = (uint32_t) (uintptr_t) &hotblocks_seed | 1;
+  }
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  hotblocks_seed = x;
+  if (0 != x % HOTBLOCKS_SAMPLE) {
+    return;
+  }
+  unsigned int *count = &hotblocks_counts[bnum];
+  __atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + 1,
+                   __ATOMIC_RELAXED);
+}
+
+// Drops a reference to the given job, freeing it with the last one.
+static void hotblocks_release(void *arg) {
+  hotblocks_job_t *job = arg;
+  if (0 == __atomic_sub_fetch(&job->running, 1, __ATOMIC_ACQ_REL)) {
+    printf("+ hotblocks_prefetch() -> done (%d blocks)\n", job->count);
+    free(job->bnums);
+    free(job);
+  }
+}
+
+// Prefetches the next few blocks of the shared job. Returns the number
+// of blocks prefetched, 0 once none are left.
+static int hotblocks_step(void *arg) {
+  hotblocks_job_t *job = arg;
+  int done = 0;
+  int idx;
+  // takes blocks in order so the hottest ones are requested first.
+  while (done < HOTBLOCKS_STEP &&
+         (idx = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+    blocks_prefetch(job->bnums[idx]);
+    ++done;
+  }
+  return done;
+}
+
+// Prefetches the blocks in the saved hot list in the background.
+int hotblocks_prefetch(int tasks) {
+  FILE *file = NULL;
+  if (NULL == hotblocks_path || NULL == (file = fopen(hotblocks_path, "r"))) {
+    return -1;
+  }
+  hotblocks_job_t *job = calloc(1, sizeof(hotblocks_job_t));
+  job->bnums = malloc(HOTBLOCKS_MAX * sizeof(int));
+  int bnum;
+  while (job->count < HOTBLOCKS_MAX && 1 == fscanf(file, "%d", &bnum)) {
+    if (0 <= bnum && bnum < BLOCK_COUNT) {
+      job->bnums[job->count++] = bnum;
+    }
+  }
+  fclose(file);
+
+  // holds a reference of its own while scheduling the tasks.
+  int count = job->count;
+  job->running = 1;
+  for (int ii = 0; ii < tasks; ++ii) {
+    __atomic_add_fetch(&job->running, 1, __ATOMIC_ACQ_REL);
+    if (0 != bgsched_submit(BGSCHED_NORMAL, 0, hotblocks_step, hotblocks_release, job)) {
+      hotblocks_release(job);
+      break;
+    }
+  }
+  hotblocks_release(job);
+  return count;
+}
+
+// Sorts block numbers by decreasing access count.
+static int hotblocks_cmp(const void *a, const void *b) {
+  unsigned int ca = hotblocks_counts[*(const int *) a];
+  unsigned int cb = hotblocks_counts[*(const int *) b];
+  return (ca < cb) - (ca > cb);
+}
+
+// Saves the hottest blocks seen, hottest first, and stops tracking.
+int hotblocks_save(void) {
+  if (NULL == hotblocks_counts) {
+    return -1;
+  }
+  int *bnums = malloc(BLOCK_COUNT * sizeof(int));
+  int count = 0;
+  for (int ii = 0; ii < BLOCK_COUNT; ++ii) {
+    if (0 != hotblocks_counts[ii]) {
+      bnums[count++] = ii;
+    }
+  }
+  qsort(bnums, count, sizeof(int), hotblocks_cmp);
+
+  // writes a temporary file first so a crash never leaves half a list.
+  int rv = -1;
+  char tmp[strlen(hotblocks_path) + sizeof(".tmp")];
+  strcpy(tmp, hotblocks_path);
+  strcat(tmp, ".tmp");
+  FILE *file = fopen(tmp, "w");
+  if (NULL != file) {
+    for (int ii = 0; ii < count && ii < HOTBLOCKS_MAX; ++ii) {
+      fprintf(file, "%d\n", bnums[ii]);
+    }
+    if (0 == fclose(file) && 0 == rename(tmp, hotblocks_path)) {
+      rv = 0;
+    }
+  }
+  printf("+ hotblocks_save() -> %d (%d blocks)\n", rv, count);
+
+  free(bnums);
+  free(hotblocks_counts);
+  hotblocks_counts = NULL;
+  return rv;
+}
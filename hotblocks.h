@@ -0,0 +1,47 @@
+// Sampled block access tracking used to warm the page cache on mount.
+#ifndef HOTBLOCKS_H
+#define HOTBLOCKS_H
+
+#define HOTBLOCKS_SAMPLE 16  // about one in this many accesses is counted
+#define HOTBLOCKS_MAX 1024   // most blocks kept in the hot list
+#define HOTBLOCKS_THREADS 4  // default number of prefetch tasks
+#define HOTBLOCKS_STEP 16    // blocks prefetched per background step
+
+/**
+ * Starts tracking block accesses for the given disk image. The hot
+ * list is kept next to the image, in a file with a ".hot" suffix.
+ *
+ * @param image_path Path to the disk image file.
+ */
+void hotblocks_init(const char *image_path);
+
+/**
+ * Counts a sampled access to the block with the given index. Called
+ * for the data blocks read and written through inodes, so metadata
+ * that stays mapped anyway, such as block 0, is not ranked.
+ *
+ * @param bnum Block number (index).
+ */
+void hotblocks_touch(int bnum);
+
+/**
+ * Prefetches the blocks in the saved hot list, hottest first, using
+ * the given number of tasks on the background scheduler, which must
+ * be running. Returns right away.
+ *
+ * @param tasks Number of prefetch tasks.
+ *
+ * @return Number of blocks queued for prefetching, or -1 if there
+ *         is no saved hot list.
+ */
+int hotblocks_prefetch(int tasks);
+
+/**
+ * Saves the hottest blocks seen since hotblocks_init, hottest first,
+ * and stops tracking.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int hotblocks_save(void);
+
+#endif
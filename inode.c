@@ -1,25 +1,161 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include "inode.h"
+#include "bgsched.h"
 #include "bitmap.h"
+#include "cbt.h"
+#include "hotblocks.h"
+#include "memops.h"
+#include "super.h"
+#include "usage.h"
+
+// serializes lazy initialization of inode table blocks.
+static pthread_mutex_t inode_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// last resolved run of physically consecutive file blocks, per inode,
+// packed as (first physical block << 32 | first file block << 16 | length)
+// so it can be read and replaced atomically; a length of 0 means empty.
+// NOTE: file blocks are only ever added past the end of a file, so a
+//       run stays valid until the file shrinks.
+static uint64_t *inode_maps = NULL;
+
+// Gets the number of blocks taken up by the inode table.
+int inode_table_blocks() { return bytes_to_blocks(INODE_COUNT * INODE_SIZE); }
+
+// Reserves space for the inode table, which starts at block 1.
+static void inode_table_reserve(void) {
+  void *bbm = get_blocks_bitmap();
+  super_t *sb = get_super();
+  for (int ii = 1; ii <= inode_table_blocks(); ++ii) {
+    if (!bitmap_get(bbm, ii)) {
+      bitmap_put(bbm, ii, 1);
+      --sb->free_blocks;
+    }
+  }
+}
 
 // Initializes and reserves space for the inode table.
 // NOTE: Reserves 0th inode so reference the 0th inode
 //       is equivalent to pointing to nothing.
 void inode_init() {
-  void *bbm = get_blocks_bitmap();
-  // reserves space for inode table
-  int blocks = bytes_to_blocks(INODE_COUNT * INODE_SIZE);
-  for (int ii = 1; ii < blocks; ++ii) {
-    bitmap_put(bbm, ii, 1);
-  }
+  inode_table_reserve();
   // reserves the 0th inode.
   void *ibm = get_inode_bitmap();
   bitmap_put(ibm, 0, 1);
+  inode_maps = calloc(INODE_COUNT, sizeof(uint64_t));
+}
+
+// Zeroes the given inode table block if it has not been initialized.
+static void inode_table_init_block(int tblock) {
+  super_t *sb = get_super();
+  unsigned int bit = 1u << tblock;
+  if (0 == (__atomic_load_n(&sb->itable_uninit, __ATOMIC_ACQUIRE) & bit)) {
+    return;
+  }
+  pthread_mutex_lock(&inode_table_lock);
+  if (sb->itable_uninit & bit) {
+    blocks_clear(1 + tblock);
+    __atomic_and_fetch(&sb->itable_uninit, ~bit, __ATOMIC_RELEASE);
+    printf("+ inode_table_init(%d)\n", 1 + tblock);
+  }
+  pthread_mutex_unlock(&inode_table_lock);
+}
+
+// Makes sure the inode table blocks holding the given inode are
+// initialized before it is first used.
+void inode_table_init(int inum) {
+  // an inode may straddle two blocks of the table.
+  inode_table_init_block(INODE_SIZE * inum / BLOCK_SIZE);
+  inode_table_init_block((INODE_SIZE * (inum + 1) - 1) / BLOCK_SIZE);
+}
+
+// Initializes the next inode table block in the background. Returns 1,
+// or 0 once every block has been initialized.
+static int inode_table_step(void *arg) {
+  int *next = arg;
+  if (inode_table_blocks() <= *next) {
+    return 0;
+  }
+  inode_table_init_block((*next)++);
+  return 1;
+}
+
+// Schedules initializing the rest of the inode table in the background.
+void inode_table_init_background() {
+  if (0 == get_super()->itable_uninit) {
+    return;
+  }
+  static int next = 0;
+  bgsched_submit(BGSCHED_LOW, INODE_TABLE_BG_RATE, inode_table_step, NULL, &next);
+}
+
+// Moves a file block that lies in the inode table to a new block,
+// updating the given pointer to it.
+static void inode_table_evict_block(int *bnum) {
+  if (*bnum < 1 || inode_table_blocks() < *bnum) {
+    return;
+  }
+  int to = alloc_block_uninit();
+  assert(-1 != to);
+  // pins both blocks, since getting the second may map over the first.
+  blocks_pin(to);
+  blocks_pin(*bnum);
+  memcpy(blocks_get_block(to), blocks_get_block(*bnum), BLOCK_SIZE);
+  blocks_unpin(*bnum);
+  blocks_unpin(to);
+  printf("+ inode_table_evict(%d) -> %d\n", *bnum, to);
+  *bnum = to;
+}
+
+// Moves the blocks of an inode in the old layout out of the table.
+// NOTE: Only reads the fields old inodes had.
+static void inode_table_evict(char *old_node) {
+  inode_t *node = (inode_t *) old_node;
+  int count = bytes_to_blocks(node->size);
+  for (int ii = 0; ii < count && ii < NDIRECT; ++ii) {
+    inode_table_evict_block(&node->direct[ii]);
+  }
+  if (count <= NDIRECT || 0 == node->indirect) {
+    return;
+  }
+  inode_table_evict_block(&node->indirect);
+  // keeps the indirect block mapped while moving the blocks it lists.
+  blocks_pin(node->indirect);
+  int *indirect = blocks_get_block(node->indirect);
+  for (int ii = 0; ii < count - NDIRECT && ii < NINDIRECT; ++ii) {
+    inode_table_evict_block(&indirect[ii]);
+  }
+  blocks_unpin(node->indirect);
+}
+
+// Moves the inodes of a table written with a smaller inode size to
+// their current places, last first since they only move up.
+void inode_table_migrate(int old_size) {
+  // images from before the superblock only reserved the blocks the
+  // old table filled completely, so files may use the rest of it.
+  inode_table_reserve();
+  void *ibm = get_inode_bitmap();
+  char *old_table = blocks_get_block(1);
+  for (int ii = 1; ii < INODE_COUNT; ++ii) {
+    if (bitmap_get(ibm, ii)) {
+      inode_table_evict(old_table + old_size * ii);
+    }
+  }
+  for (int ii = 0; ii < inode_table_blocks(); ++ii) {
+    inode_table_init_block(ii);
+  }
+  char *table = blocks_get_block(1);
+  for (int ii = INODE_COUNT - 1; ii >= 0; --ii) {
+    memmove(table + INODE_SIZE * ii, table + old_size * ii, old_size);
+    memset(table + INODE_SIZE * ii + old_size, 0, INODE_SIZE - old_size);
+  }
+  printf("+ inode_table_migrate(%d) -> %d\n", old_size, INODE_SIZE);
 }
 
 // Gets the inode at the given index in the inode table.
@@ -37,14 +173,30 @@ inode_t *get_inode(int inum) {
 // Allocate a new inode and return its index.
 int alloc_inode(int mode) {
   void *ibm = get_inode_bitmap();
-  // allocates next unused inode in inode table.
+  super_t *sb = get_super();
+  if (sb->free_inodes <= 0) {
+    return -1;
+  }
+  // allocates next unused inode in inode table, starting from where
+  // the last allocation left off.
   // skips inode 0 and 1 since they are reserved.
-  for (int ii = 2; ii < INODE_COUNT; ++ii) {
+  int start = sb->inode_cursor;
+  if (start < 2 || INODE_COUNT <= start) {
+    start = 2;
+  }
+  for (int jj = 0; jj < INODE_COUNT - 2; ++jj) {
+    int ii = 2 + (start - 2 + jj) % (INODE_COUNT - 2);
     if (!bitmap_get(ibm, ii)) {
+      inode_table_init(ii);
       inode_t *node = get_inode(ii);
       bitmap_put(ibm, ii, 1);
+      --sb->free_inodes;
+      sb->inode_cursor = ii + 1;
       node->mode = mode;
       node->inum = ii;
+      node->parent = 0;
+      node->parent_slot = 0;
+      usage_add(node, 0, 0, 1);
       printf("+ alloc_inode() -> %d\n", ii);
       return ii;
     }
@@ -59,10 +211,32 @@ void free_inode(int inum) {
   if (bitmap_get(ibm, inum)) {
     inode_t *node = get_inode(inum);
     shrink_inode(node, 0);
+    usage_add(node, 0, 0, -1);
     bitmap_put(ibm, inum, 0);
+    ++get_super()->free_inodes;
   }
 }
 
+// Finds the first allocated inode from the given number on, passing
+// over whole bytes of the inode bitmap with no inodes in use.
+int inode_next(int inum) {
+  uint8_t *ibm = get_inode_bitmap();
+  // inode 0 is reserved.
+  if (inum < 1) {
+    inum = 1;
+  }
+  while (inum < INODE_COUNT) {
+    if (0 == inum % 8 && 0 == ibm[inum / 8]) {
+      inum += 8;
+    } else if (bitmap_get(ibm, inum)) {
+      return inum;
+    } else {
+      ++inum;
+    }
+  }
+  return -1;
+}
+
 // Checks if the given inode is valid and inuse.
 int inode_valid(inode_t *node) {
   void *ibm = get_inode_bitmap();
@@ -92,6 +266,80 @@ int *inode_get_bnum(inode_t *node, int file_bnum) {
   return &indirect[file_bnum - NDIRECT];
 }
 
+// Gets the block number of the file block of the given index, or 0 if
+// it has none, pinning the indirect block while reading from it.
+int inode_find_bnum(inode_t *node, int file_bnum) {
+  if (!inode_valid(node) || file_bnum < 0 || NINDIRECT + NDIRECT <= file_bnum) {
+    return 0;
+  }
+  if (file_bnum < NDIRECT) {
+    return node->direct[file_bnum];
+  }
+  int bnum = node->indirect;
+  if (0 == bnum) {
+    return 0;
+  }
+  blocks_pin(bnum);
+  int *indirect = blocks_get_block(bnum);
+  int rv = indirect[file_bnum - NDIRECT];
+  blocks_unpin(bnum);
+  return rv;
+}
+
+// Sets the block number of the file block of the given index, pinning
+// the indirect block while writing to it.
+// NOTE: Assumes the indirect block is allocated if the index needs it.
+static void inode_set_bnum(inode_t *node, int file_bnum, int bnum) {
+  if (file_bnum < NDIRECT) {
+    node->direct[file_bnum] = bnum;
+    return;
+  }
+  blocks_pin(node->indirect);
+  int *indirect = blocks_get_block(node->indirect);
+  indirect[file_bnum - NDIRECT] = bnum;
+  blocks_unpin(node->indirect);
+  cbt_mark(node->indirect);
+}
+
+// Forgets the cached block run of the given inode.
+static void inode_map_invalidate(inode_t *node) {
+  if (NULL != inode_maps) {
+    __atomic_store_n(&inode_maps[node->inum], 0, __ATOMIC_RELAXED);
+  }
+}
+
+// Gets the block holding the given file block, and sets run to the
+// number of file blocks from there that are in consecutive blocks, also
+// consecutive in memory. Sequential access is served from the run
+// cached for the inode, resolving the block map once per run.
+// NOTE: Assumes the file block is in bounds of the file.
+static int inode_map(inode_t *node, int file_bnum, int *run) {
+  uint64_t map = NULL == inode_maps ? 0 : __atomic_load_n(&inode_maps[node->inum], __ATOMIC_RELAXED);
+  int length = map & 0xffff;
+  int first = (map >> 16) & 0xffff;
+  if (first <= file_bnum && file_bnum < first + length) {
+    *run = length - (file_bnum - first);
+    return (int) (map >> 32) + file_bnum - first;
+  }
+
+  int bnum = inode_find_bnum(node, file_bnum);
+  int contiguous = blocks_contiguous(bnum);
+  int count = bytes_to_blocks(node->size) - file_bnum;
+  length = 1;
+  while (length < contiguous && length < count) {
+    if (bnum + length != inode_find_bnum(node, file_bnum + length)) {
+      break;
+    }
+    ++length;
+  }
+  if (NULL != inode_maps) {
+    map = (uint64_t) bnum << 32 | (uint64_t) file_bnum << 16 | length;
+    __atomic_store_n(&inode_maps[node->inum], map, __ATOMIC_RELAXED);
+  }
+  *run = length;
+  return bnum;
+}
+
 // Gets a pointer to the file byte of the given index.
 char *inode_get_byte(inode_t *node, int file_byte) {
   // checks if the byte index is in bounds of the file.
@@ -100,7 +348,7 @@ char *inode_get_byte(inode_t *node, int file_byte) {
   }
   // block where byte is has definitely been allocated.
   int bnum = file_byte / BLOCK_SIZE;
-  bnum = *inode_get_bnum(node, bnum);
+  bnum = inode_find_bnum(node, bnum);
   char *ptr = blocks_get_block(bnum);
   return ptr + file_byte % BLOCK_SIZE;
 }
@@ -116,8 +364,22 @@ int alloc_indirect(inode_t *node) {
   return 0;
 }
 
+// Sets the size of an inode, counting the change in its usage.
+static void inode_set_size(inode_t *node, int size) {
+  usage_add(node, size - node->size,
+            bytes_to_blocks(size) - bytes_to_blocks(node->size), 0);
+  node->size = size;
+}
+
 // Increases size of inode. Returns -1 if operation fails.
 int grow_inode(inode_t *node, int size) {
+  return grow_inode_over(node, size, 0, 0);
+}
+
+// Increases size of inode, leaving new blocks that lie entirely in the
+// byte range [over_from, over_to) uninitialized since the caller is
+// about to overwrite them. Returns -1 if operation fails.
+int grow_inode_over(inode_t *node, int size, int over_from, int over_to) {
   // checks if arguments are valid.
   if (!inode_valid(node) || size < node->size) {
     return -1;
@@ -126,6 +388,21 @@ int grow_inode(inode_t *node, int size) {
   int curr_bcount = bytes_to_blocks(node->size);
   int target_bcount = bytes_to_blocks(size);
 
+  // clears stale bytes past the end of the last block left behind by
+  // an earlier shrink, unless they are about to be overwritten; newly
+  // allocated blocks are already zeroed.
+  int tail = node->size % BLOCK_SIZE;
+  int tail_end = BLOCK_SIZE * curr_bcount;
+  if (0 != tail && node->size < size &&
+      !(over_from <= node->size && tail_end <= over_to)) {
+    int last_bnum = inode_find_bnum(node, curr_bcount - 1);
+    blocks_pin(last_bnum);
+    char *last = blocks_get_block(last_bnum);
+    memset(last + tail, 0, BLOCK_SIZE - tail);
+    blocks_unpin(last_bnum);
+    cbt_mark(last_bnum);
+  }
+
   while (curr_bcount < target_bcount) {
     // NOTE: takes advantage of short-circuit logical operators
     // to work. if the direct block pointers are all already
@@ -134,21 +411,25 @@ int grow_inode(inode_t *node, int size) {
     // only runs if the other two conditions are fulfilled),
     // then abort.
     if (NDIRECT <= curr_bcount && 0 == node->indirect && -1 == alloc_indirect(node)) {
-      node->size = BLOCK_SIZE * curr_bcount;
+      inode_set_size(node, BLOCK_SIZE * curr_bcount);
       return -1;
     }
-    int bnum = alloc_block();
+    // skips zeroing blocks that will be overwritten whole.
+    int block_start = BLOCK_SIZE * curr_bcount;
+    int overwritten = over_from <= block_start &&
+                      block_start + BLOCK_SIZE <= over_to;
+    int bnum = overwritten ? alloc_block_uninit() : alloc_block();
     // aborts if block allocation fails.
     if (-1 == bnum) {
-      node->size = BLOCK_SIZE * curr_bcount;
+      inode_set_size(node, BLOCK_SIZE * curr_bcount);
       return -1;
     }
     // assigns the next file block.
-    *inode_get_bnum(node, curr_bcount) = bnum;
+    inode_set_bnum(node, curr_bcount, bnum);
     ++curr_bcount;
   }
 
-  node->size = size;
+  inode_set_size(node, size);
   return 0;
 }
 
@@ -162,17 +443,19 @@ int shrink_inode(inode_t *node, int size) {
 
   int curr_bcount = bytes_to_blocks(node->size);
   int target_bcount = bytes_to_blocks(size);
+  // freed blocks may be handed out again, so cached runs must go.
+  inode_map_invalidate(node);
 
   while (target_bcount < curr_bcount) {
-    int *block = inode_get_bnum(node, curr_bcount - 1);
+    int bnum = inode_find_bnum(node, curr_bcount - 1);
     // aborts if file block is out of bounds or there is a gap
     // in the file block cache.
-    if (NULL == block || 0 == *block) {
-      continue;
+    if (0 == bnum) {
+      break;
     }
 
-    free_block(*block);
-    *block = 0;
+    free_block(bnum);
+    inode_set_bnum(node, curr_bcount - 1, 0);
     --curr_bcount;
   }
 
@@ -182,26 +465,61 @@ int shrink_inode(inode_t *node, int size) {
     node->indirect = 0;
   }
 
-  node->size = size;
+  inode_set_size(node, size);
   return size;
 }
 
+// Gets a pointer to the given file byte and the number of bytes from
+// there, up to the given limit, that are stored in physically
+// consecutive blocks and can be copied as one span. Pins the span,
+// which never crosses a window, until the caller unpins it.
+// NOTE: Assumes the file byte is in bounds of the file.
+char *inode_get_span(inode_t *node, int file_byte, int limit, int *len,
+                     int *pinned) {
+  int run;
+  int bnum = inode_map(node, file_byte / BLOCK_SIZE, &run);
+  int span = BLOCK_SIZE * run - file_byte % BLOCK_SIZE;
+  *len = span < limit ? span : limit;
+  // pins before getting the address, so a concurrent reader mapping
+  // another window can not unmap this one during the copy.
+  blocks_pin(bnum);
+  *pinned = bnum;
+  char *ptr = blocks_get_block(bnum);
+  return ptr + file_byte % BLOCK_SIZE;
+}
+
+// Counts accesses to the blocks of a span starting at the given block
+// and file byte, for the hot block list.
+static void inode_touch_span(int bnum, int file_byte, int len) {
+  int count = (file_byte % BLOCK_SIZE + len - 1) / BLOCK_SIZE + 1;
+  for (int ii = 0; ii < count; ++ii) {
+    hotblocks_touch(bnum + ii);
+  }
+}
+
 // Reads the given number of bytes from the given file into
 // the given buffer starting at the given byte index.
 int inode_read(inode_t *node, char *buf, int offset, int n) {
   if (!inode_valid(node) || offset < 0 || n < 0) {
     return -1;
   }
+  if (node->size <= offset) {
+    return 0;
+  }
+  if (node->size - offset < n) {
+    n = node->size - offset;
+  }
 
+  // copies the file one run of consecutive blocks at a time.
+  memops_copy_t copy = memops_copy_for(n);
   int i = 0;
-  while(i < n) {
-    if (node->size <= offset + i) {
-      return i;
-    }
-    // byte is definitely accessible
-    *buf = *inode_get_byte(node, offset + i);
-    ++buf;
-    ++i;
+  while (i < n) {
+    int len, pinned;
+    char *src = inode_get_span(node, offset + i, n - i, &len, &pinned);
+    copy(buf + i, src, len);
+    blocks_unpin(pinned);
+    inode_touch_span(pinned, offset + i, len);
+    i += len;
   }
   return i;
 }
@@ -213,19 +531,34 @@ int inode_write(inode_t *node, const char *buf, int offset, int n) {
     return -1;
   }
 
-  // ensures enough blocks before writing.
-  grow_inode(node, offset + n);
+  // ensures enough blocks before writing, without clearing the ones
+  // this write fills completely (e.g. block aligned direct I/O).
+  if (node->size < offset + n) {
+    grow_inode_over(node, offset + n, offset, offset + n);
+  }
+  // writes only as much as the file could grow to.
+  if (node->size <= offset) {
+    // FUSE documentation says write cannot return 0.
+    return -1;
+  }
+  if (node->size - offset < n) {
+    n = node->size - offset;
+  }
 
+  // copies the data one run of consecutive blocks at a time.
+  memops_copy_t copy = memops_copy_for(n);
   int i = 0;
-  while(i < n) {
-    if (node->size <= offset + i) {
-      // FUSE documentation says write cannot return 0.
-      return (i == 0) ? -1 : i;
-    }
-    // byte is definitely accessible
-    *inode_get_byte(node, offset + i)= *buf;
-    ++buf;
-    ++i;
+  while (i < n) {
+    int len, pinned;
+    char *dst = inode_get_span(node, offset + i, n - i, &len, &pinned);
+    copy(dst, buf + i, len);
+    blocks_unpin(pinned);
+    inode_touch_span(pinned, offset + i, len);
+    i += len;
+  }
+  // records the blocks written for incremental backups.
+  for (int fb = offset / BLOCK_SIZE; fb <= (offset + i - 1) / BLOCK_SIZE; ++fb) {
+    cbt_mark(inode_find_bnum(node, fb));
   }
 
   return i;
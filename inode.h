@@ -9,6 +9,7 @@
 #define NDIRECT 12         // number of direct block pointers
 #define NINDIRECT 1024     // number of indirect block pointers
                            // INDIRECT = BLOCK_SIZE / sizeof(int)
+#define INODE_TABLE_BG_RATE 64 // inode table blocks zeroed per second in the background
 extern const int INODE_COUNT;  // there are at most as many inodes as blocks (default = 256)
 extern const int INODE_SIZE;   // the size the inode struct in bytes (default = sizeof(inode_t))
 
@@ -22,13 +23,52 @@ typedef struct inode_t {
   int size;            // bytes
   int direct[NDIRECT]; // direct pointers
   int indirect;        // indirect pointer
-} inode_t;             // struct size : 72 bytes
+  int parent;          // directory last linked to, 0 if unknown
+  int parent_slot;     // index of its entry there, a hint
+} inode_t;             // struct size : 80 bytes, 5 table blocks
+
+#define INODE_SIZE_V1 72 // inode size of format version 1, before parents
 
 /**
  * Initializes and reserves space for the inode table.
  */
 void inode_init(void);
 
+/**
+ * Gets the number of blocks taken up by the inode table, which
+ * starts at block 1.
+ *
+ * @return Number of inode table blocks.
+ */
+int inode_table_blocks(void);
+
+/**
+ * Makes sure the inode table blocks holding the given inode are
+ * initialized. Blocks of a newly formatted table are only zeroed
+ * when the first inode in them is allocated.
+ *
+ * @param inum Inode number (index).
+ */
+void inode_table_init(int inum);
+
+/**
+ * Schedules a low priority, rate limited background task zeroing all
+ * inode table blocks that have not been initialized yet. The
+ * background scheduler must be running.
+ */
+void inode_table_init_background(void);
+
+/**
+ * Converts an inode table written with inodes of the given, smaller,
+ * size to the current layout, in place. Fields the old inodes did not
+ * have are zeroed. File blocks in the part of the table that was not
+ * reserved before are first moved to new blocks, so the free counts
+ * must be correct. Uninitialized table blocks are zeroed.
+ *
+ * @param old_size Inode size the table was written with.
+ */
+void inode_table_migrate(int old_size);
+
 /**
  * Get the inode with the given index.
  *
@@ -55,6 +95,17 @@ int alloc_inode(int mode);
  */
 void free_inode(int inum);
 
+/**
+ * Finds the first allocated inode numbered at or after the given
+ * number, skipping over free parts of the inode bitmap a byte at a
+ * time.
+ *
+ * @param inum Inode number (index) to start at.
+ *
+ * @return Number of the allocated inode, or -1 if there are none left.
+ */
+int inode_next(int inum);
+
 /**
  * Checks the given inode is valid and in use.
  *
@@ -76,6 +127,18 @@ int inode_valid(inode_t *node);
  */
 int *inode_get_bnum(inode_t *node, int file_bnum);
 
+/**
+ * Gets the block number of the file block of the given index, keeping
+ * the indirect block mapped while reading it, so it is safe for
+ * concurrent readers of a windowed mapping.
+ *
+ * @param node Inode of the file.
+ * @param file_bnum File block number (index).
+ *
+ * @return Block number of the file block, or 0 if it has none.
+ */
+int inode_find_bnum(inode_t *node, int file_bnum);
+
 /**
  * Gets a pointer to the file byte of the given index.
  *
@@ -86,6 +149,24 @@ int *inode_get_bnum(inode_t *node, int file_bnum);
  */
 char *inode_get_byte(inode_t *node, int file_byte);
 
+/**
+ * Gets a pointer to the file byte of the given index along with
+ * the length of the span of bytes from there that are stored in
+ * physically consecutive blocks, so they can be copied at once. The
+ * span stays mapped until the caller unpins it.
+ *
+ * @param node Inode of the file.
+ * @param file_byte File byte number (index), in bounds of the file.
+ * @param limit Maximum length of the span in bytes.
+ * @param len Set to the length of the span in bytes.
+ * @param pinned Set to the block to pass to blocks_unpin once the
+ *        caller is done with the span.
+ *
+ * @return Pointer to the file byte of the given index.
+ */
+char *inode_get_span(inode_t *node, int file_byte, int limit, int *len,
+                     int *pinned);
+
 /**
  * Grows the given file to the given size, allocating
  * blocks as needed.
@@ -97,6 +178,20 @@ char *inode_get_byte(inode_t *node, int file_byte);
  */
 int grow_inode(inode_t *node, int size);
 
+/**
+ * Grows the given file to the given size like grow_inode, except that
+ * new blocks lying entirely in the given byte range are not cleared,
+ * since the caller is about to overwrite all of them.
+ *
+ * @param node Inode of the file.
+ * @param size Size to grow the file to in bytes.
+ * @param over_from First byte the caller will overwrite.
+ * @param over_to Byte after the last one the caller will overwrite.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int grow_inode_over(inode_t *node, int size, int over_from, int over_to);
+
 /**
  * Shrinks the given file to the given size, deallocating
  * blocks as needed.
@@ -0,0 +1,299 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fuse.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "loop.h"
+#include "qos.h"
+#include "workpool.h"
+#include <fuse_lowlevel.h>
+
+#define LOOP_MAX_WORKERS 256
+#define LOOP_PENDING_PER_WORKER 16
+
+// A reader thread and the channel it reads requests from.
+typedef struct loop_reader_t {
+  pthread_t thread;
+  struct fuse_chan *ch; // channel read from and replied to
+  int cloned;           // whether the channel was cloned for this reader
+  int cpu;              // CPU to run on, or -1 for any
+  struct loop_t *loop;
+} loop_reader_t;
+
+// A request read from a channel, waiting to be processed by the pool.
+typedef struct loop_req_t {
+  struct loop_t *loop;
+  struct fuse_chan *ch; // channel to reply on
+  size_t len;
+  struct loop_req_t *next; // next free request buffer
+  char buf[];
+} loop_req_t;
+
+// State shared by all readers of a loop.
+typedef struct loop_t {
+  struct fuse_session *se;
+  workpool_t *pool;
+  size_t bufsize;
+  pthread_mutex_t free_lock;
+  loop_req_t *free_reqs; // request buffers ready for reuse
+  sem_t finish;          // posted when a reader stops
+} loop_t;
+
+// Takes a request buffer from the free list, or allocates a new one.
+static loop_req_t *loop_req_get(loop_t *loop) {
+  pthread_mutex_lock(&loop->free_lock);
+  loop_req_t *req = loop->free_reqs;
+  if (NULL != req) {
+    loop->free_reqs = req->next;
+  }
+  pthread_mutex_unlock(&loop->free_lock);
+  if (NULL == req) {
+    req = malloc(sizeof(loop_req_t) + loop->bufsize);
+    if (NULL != req) {
+      req->loop = loop;
+    }
+  }
+  return req;
+}
+
+// Returns a request buffer to the free list.
+static void loop_req_put(void *arg) {
+  loop_req_t *req = arg;
+  if (NULL == req) {
+    return;
+  }
+  loop_t *loop = req->loop;
+  pthread_mutex_lock(&loop->free_lock);
+  req->next = loop->free_reqs;
+  loop->free_reqs = req;
+  pthread_mutex_unlock(&loop->free_lock);
+}
+
+// Processes a request on a pool worker; the operation replies on the
+// request's channel when it completes.
+static void loop_process(void *arg) {
+  loop_req_t *req = arg;
+  fuse_session_process(req->loop->se, req->buf, req->len, req->ch);
+  loop_req_put(req);
+}
+
+// Sends a reply on a cloned channel.
+static int loop_chan_send(struct fuse_chan *ch, const struct iovec iov[],
+                          size_t count) {
+  if (-1 == writev(fuse_chan_fd(ch), iov, count)) {
+    int err = errno;
+    // ENOENT means the request was interrupted and is gone.
+    if (ENOENT != err) {
+      perror("fuse: writing device");
+    }
+    return -err;
+  }
+  return 0;
+}
+
+// Closes a cloned channel.
+static void loop_chan_destroy(struct fuse_chan *ch) { close(fuse_chan_fd(ch)); }
+
+static struct fuse_chan_ops loop_chan_ops = {
+  .receive = NULL,
+  .send = loop_chan_send,
+  .destroy = loop_chan_destroy,
+};
+
+// Clones the device fd of the given channel into a new channel on the
+// same connection, and so the same request queue in the kernel.
+// Returns NULL if cloning fails.
+static struct fuse_chan *loop_clone_chan(struct fuse_chan *master) {
+  int fd = open("/dev/fuse", O_RDWR | O_CLOEXEC);
+  if (-1 == fd) {
+    return NULL;
+  }
+  uint32_t master_fd = fuse_chan_fd(master);
+  if (-1 == ioctl(fd, FUSE_DEV_IOC_CLONE, &master_fd)) {
+    close(fd);
+    return NULL;
+  }
+  struct fuse_chan *ch =
+      fuse_chan_new(&loop_chan_ops, fd, fuse_chan_bufsize(master), NULL);
+  if (NULL == ch) {
+    close(fd);
+  }
+  return ch;
+}
+
+// Reads requests from the reader's channel and hands them to the pool.
+static void *loop_reader(void *arg) {
+  loop_reader_t *r = arg;
+  loop_t *loop = r->loop;
+  struct fuse_session *se = loop->se;
+  int fd = fuse_chan_fd(r->ch);
+
+  if (-1 != r->cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(r->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+
+  while (!fuse_session_exited(se)) {
+    loop_req_t *req = loop_req_get(loop);
+    if (NULL == req) {
+      perror("fuse: allocating request");
+      break;
+    }
+    // only waiting for a request may be cancelled.
+    ssize_t res;
+    pthread_cleanup_push(loop_req_put, req);
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    res = read(fd, req->buf, loop->bufsize);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+    pthread_cleanup_pop(0);
+    if (-1 == res) {
+      int err = errno;
+      loop_req_put(req);
+      // ENOENT means the request was interrupted before it was read.
+      if (EINTR == err || EAGAIN == err || ENOENT == err) {
+        continue;
+      }
+      // ENODEV means the file system was unmounted.
+      if (ENODEV != err) {
+        errno = err;
+        perror("fuse: reading device");
+      }
+      break;
+    }
+    req->ch = r->ch;
+    req->len = res;
+    // metadata goes ahead of bulk data, and clients over their limits are
+    // held back. blocks while the pool is full, leaving requests queued in
+    // the kernel.
+    int priority;
+    uint64_t when = qos_schedule(req->buf, req->len, &priority);
+    if (0 != workpool_submit_at(loop->pool, priority, when, loop_process, req)) {
+      loop_req_put(req);
+      break;
+    }
+  }
+
+  fuse_session_exit(se);
+  sem_post(&loop->finish);
+  return NULL;
+}
+
+// Serves requests until the file system is unmounted or interrupted.
+int loop_run(struct fuse *fuse, const loop_opts_t *opts) {
+  loop_t loop;
+  loop.se = fuse_get_session(fuse);
+  struct fuse_chan *master = fuse_session_next_chan(loop.se, NULL);
+  loop.bufsize = fuse_chan_bufsize(master);
+  loop.free_reqs = NULL;
+  pthread_mutex_init(&loop.free_lock, NULL);
+  sem_init(&loop.finish, 0, 0);
+
+  int count = opts->workers;
+  if (count <= 0) {
+    count = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (count < 1) {
+    count = 1;
+  } else if (LOOP_MAX_WORKERS < count) {
+    count = LOOP_MAX_WORKERS;
+  }
+  int max_pending = opts->max_pending;
+  if (max_pending <= 0) {
+    max_pending = count * LOOP_PENDING_PER_WORKER;
+  }
+  qos_init(&opts->qos);
+  // starts the threads with every signal blocked, as fuse_loop_mt does,
+  // so the signals ending the session are handled by the main thread.
+  sigset_t all, saved;
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &saved);
+  // spreads the workers over the allowed CPUs; with clone_fd, worker N
+  // shares its CPU with reader N, so a request it reads is likely
+  // processed without leaving that CPU's caches.
+  loop.pool = workpool_new(count, max_pending, WORKPOOL_PIN);
+
+  // one reader per fd: the original one, plus a clone per worker.
+  int nreaders = opts->clone_fd ? count : 1;
+  loop_reader_t *readers = NULL;
+  if (NULL != loop.pool) {
+    readers = calloc(nreaders, sizeof(loop_reader_t));
+  }
+  if (NULL == readers) {
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+    if (NULL != loop.pool) {
+      workpool_free(loop.pool);
+    }
+    pthread_mutex_destroy(&loop.free_lock);
+    sem_destroy(&loop.finish);
+    return -1;
+  }
+  int started = 0;
+  int clones = 0;
+  for (int ii = 0; ii < nreaders; ++ii) {
+    loop_reader_t *r = &readers[ii];
+    r->loop = &loop;
+    r->ch = master;
+    r->cpu = -1;
+    // the first reader keeps the original fd, the others get clones;
+    // a reader shares the original fd if cloning is not supported.
+    if (opts->clone_fd) {
+      r->cpu = workpool_cpu(ii);
+      if (0 < ii) {
+        struct fuse_chan *ch = loop_clone_chan(master);
+        if (NULL != ch) {
+          r->ch = ch;
+          r->cloned = 1;
+          ++clones;
+        }
+      }
+    }
+    if (0 != pthread_create(&r->thread, NULL, loop_reader, r)) {
+      perror("fuse: starting reader");
+      if (r->cloned) {
+        fuse_chan_destroy(r->ch);
+      }
+      break;
+    }
+    ++started;
+  }
+  pthread_sigmask(SIG_SETMASK, &saved, NULL);
+  printf("+ loop_run() -> %d workers, %d readers, %d cloned fds, %d pending\n",
+         count, started, clones, max_pending);
+
+  // waits for a reader to stop or a signal to end the session.
+  while (0 < started && !fuse_session_exited(loop.se)) {
+    sem_wait(&loop.finish);
+  }
+  for (int ii = 0; ii < started; ++ii) {
+    pthread_cancel(readers[ii].thread);
+    pthread_join(readers[ii].thread, NULL);
+  }
+  // finishes the requests already read before closing their channels.
+  workpool_free(loop.pool);
+  for (int ii = 0; ii < started; ++ii) {
+    if (readers[ii].cloned) {
+      fuse_chan_destroy(readers[ii].ch);
+    }
+  }
+  free(readers);
+  while (NULL != loop.free_reqs) {
+    loop_req_t *next = loop.free_reqs->next;
+    free(loop.free_reqs);
+    loop.free_reqs = next;
+  }
+  pthread_mutex_destroy(&loop.free_lock);
+  sem_destroy(&loop.finish);
+  fuse_session_reset(loop.se);
+  return 0 < started ? 0 : -1;
+}
@@ -0,0 +1,46 @@
+// Asynchronous FUSE request loop on a work-stealing pool.
+#ifndef LOOP_H
+#define LOOP_H
+
+#ifndef FUSE_USE_VERSION
+#define FUSE_USE_VERSION 26
+#endif
+#include <fuse.h>
+
+#include "qos.h"
+
+// Options for the request loop.
+typedef struct loop_opts_t {
+  int workers;     // number of worker threads (0 = one per CPU)
+  int clone_fd;    // give each reader its own cloned /dev/fuse fd and CPU
+  int max_pending; // requests read but not yet replied to (0 = default)
+  qos_opts_t qos;  // per-client limits
+} loop_opts_t;
+
+/**
+ * Serves requests for the given mounted file system until it is
+ * unmounted or interrupted, replacing fuse_loop_mt.
+ *
+ * Reader threads only read requests and hand them to a work-stealing
+ * pool of workers, which process them and reply when each operation
+ * completes, so a slow operation holds one worker while the readers
+ * keep feeding the others. At most max_pending requests are in flight;
+ * beyond that the readers stop reading and requests wait in the kernel.
+ * Metadata requests are processed ahead of reads and writes, and each
+ * uid is held to the qos limits without holding back other uids. The
+ * workers are pinned round robin to the CPUs the process may run on.
+ *
+ * With clone_fd there is one reader per worker, each pinned to its own
+ * CPU and reading from its own /dev/fuse fd cloned with
+ * FUSE_DEV_IOC_CLONE. The clones still share the connection's single
+ * input queue in the kernel; what they give each reader is its own fd
+ * to reply on and less contention on the one fd's file lock.
+ *
+ * @param fuse File system set up with fuse_setup.
+ * @param opts Loop options.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+int loop_run(struct fuse *fuse, const loop_opts_t *opts);
+
+#endif
@@ -0,0 +1,145 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MEMOPS_X86 1
+#endif
+
+#include "memops.h"
+
+// copy kernel used for transfers above the streaming threshold.
+static memops_copy_t memops_stream = memcpy;
+
+#ifdef MEMOPS_X86
+// Gets the number of bytes to copy before dst reaches the given alignment.
+static size_t memops_head(const void *dst, size_t align, size_t n) {
+  size_t head = (align - ((uintptr_t) dst & (align - 1))) & (align - 1);
+  return head < n ? head : n;
+}
+
+// Streaming copy using 16 byte SSE2 non-temporal stores.
+__attribute__((target("sse2")))
+static void *memops_copy_sse2(void *dst, const void *src, size_t n) {
+  char *d = dst;
+  const char *s = src;
+  size_t head = memops_head(d, 16, n);
+  memcpy(d, s, head);
+  d += head, s += head, n -= head;
+  while (n >= 64) {
+    __m128i a = _mm_loadu_si128((const __m128i *) s);
+    __m128i b = _mm_loadu_si128((const __m128i *) (s + 16));
+    __m128i c = _mm_loadu_si128((const __m128i *) (s + 32));
+    __m128i e = _mm_loadu_si128((const __m128i *) (s + 48));
+    _mm_stream_si128((__m128i *) d, a);
+    _mm_stream_si128((__m128i *) (d + 16), b);
+    _mm_stream_si128((__m128i *) (d + 32), c);
+    _mm_stream_si128((__m128i *) (d + 48), e);
+    d += 64, s += 64, n -= 64;
+  }
+  _mm_sfence();
+  memcpy(d, s, n);
+  return dst;
+}
+
+// Streaming copy using 32 byte AVX2 non-temporal stores.
+__attribute__((target("avx2")))
+static void *memops_copy_avx2(void *dst, const void *src, size_t n) {
+  char *d = dst;
+  const char *s = src;
+  size_t head = memops_head(d, 32, n);
+  memcpy(d, s, head);
+  d += head, s += head, n -= head;
+  while (n >= 128) {
+    __m256i a = _mm256_loadu_si256((const __m256i *) s);
+    __m256i b = _mm256_loadu_si256((const __m256i *) (s + 32));
+    __m256i c = _mm256_loadu_si256((const __m256i *) (s + 64));
+    __m256i e = _mm256_loadu_si256((const __m256i *) (s + 96));
+    _mm256_stream_si256((__m256i *) d, a);
+    _mm256_stream_si256((__m256i *) (d + 32), b);
+    _mm256_stream_si256((__m256i *) (d + 64), c);
+    _mm256_stream_si256((__m256i *) (d + 96), e);
+    d += 128, s += 128, n -= 128;
+  }
+  _mm_sfence();
+  memcpy(d, s, n);
+  return dst;
+}
+
+// Streaming copy using 64 byte AVX-512 non-temporal stores.
+__attribute__((target("avx512f")))
+static void *memops_copy_avx512(void *dst, const void *src, size_t n) {
+  char *d = dst;
+  const char *s = src;
+  size_t head = memops_head(d, 64, n);
+  memcpy(d, s, head);
+  d += head, s += head, n -= head;
+  while (n >= 256) {
+    __m512i a = _mm512_loadu_si512((const void *) s);
+    __m512i b = _mm512_loadu_si512((const void *) (s + 64));
+    __m512i c = _mm512_loadu_si512((const void *) (s + 128));
+    __m512i e = _mm512_loadu_si512((const void *) (s + 192));
+    _mm512_stream_si512((void *) d, a);
+    _mm512_stream_si512((void *) (d + 64), b);
+    _mm512_stream_si512((void *) (d + 128), c);
+    _mm512_stream_si512((void *) (d + 192), e);
+    d += 256, s += 256, n -= 256;
+  }
+  _mm_sfence();
+  memcpy(d, s, n);
+  return dst;
+}
+#endif
+
+// Selects the streaming kernels supported by the CPU.
+void memops_init(void) {
+#ifdef MEMOPS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    memops_stream = memops_copy_avx512;
+    printf("+ memops_init() -> avx512\n");
+  } else if (__builtin_cpu_supports("avx2")) {
+    memops_stream = memops_copy_avx2;
+    printf("+ memops_init() -> avx2\n");
+  } else if (__builtin_cpu_supports("sse2")) {
+    memops_stream = memops_copy_sse2;
+    printf("+ memops_init() -> sse2\n");
+  }
+#endif
+}
+
+// Gets the copy kernel to use for a transfer of the given total size.
+memops_copy_t memops_copy_for(size_t total) {
+  return total < MEMOPS_STREAM_THRESHOLD ? memcpy : memops_stream;
+}
+
+// Fills the given region with zeros, streaming around the cache.
+void memops_zero_stream(void *dst, size_t n) {
+#ifdef __SSE2__
+  char *ptr = dst;
+  // clears the unaligned head with regular stores.
+  size_t head = (16 - ((uintptr_t) ptr & 15)) & 15;
+  if (head > n) {
+    head = n;
+  }
+  memset(ptr, 0, head);
+  ptr += head;
+  n -= head;
+  // streams the aligned body 64 bytes (one cache line) at a time.
+  __m128i zero = _mm_setzero_si128();
+  while (n >= 64) {
+    _mm_stream_si128((__m128i *) ptr, zero);
+    _mm_stream_si128((__m128i *) (ptr + 16), zero);
+    _mm_stream_si128((__m128i *) (ptr + 32), zero);
+    _mm_stream_si128((__m128i *) (ptr + 48), zero);
+    ptr += 64;
+    n -= 64;
+  }
+  // orders the streaming stores before any later regular store.
+  _mm_sfence();
+  memset(ptr, 0, n);
+#else
+  memset(dst, 0, n);
+#endif
+}
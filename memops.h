@@ -0,0 +1,41 @@
+// Bulk memory kernels used on the block data path.
+#ifndef MEMOPS_H
+#define MEMOPS_H
+
+#include <stddef.h>
+
+// transfers of at least this many bytes bypass the CPU cache.
+#define MEMOPS_STREAM_THRESHOLD (64 * 1024)
+
+// signature shared by memcpy and the streaming copy kernels.
+typedef void *(*memops_copy_t)(void *dst, const void *src, size_t n);
+
+/**
+ * Selects the fastest streaming kernels the CPU supports (AVX-512,
+ * AVX2 or SSE2). Until called, all copies use plain memcpy.
+ */
+void memops_init(void);
+
+/**
+ * Gets the copy kernel to use for a transfer of the given total size:
+ * memcpy below MEMOPS_STREAM_THRESHOLD, otherwise a kernel using
+ * non-temporal stores so streamed file data does not evict metadata
+ * such as the inode table and bitmaps from the CPU cache.
+ *
+ * @param total Total number of bytes of the transfer.
+ *
+ * @return Copy kernel for the transfer.
+ */
+memops_copy_t memops_copy_for(size_t total);
+
+/**
+ * Fills the given region with zeros using non-temporal stores so the
+ * cleared bytes do not displace hot metadata from the CPU cache. Falls
+ * back to memset on targets without streaming stores.
+ *
+ * @param dst Start of the region to clear.
+ * @param n Number of bytes to clear.
+ */
+void memops_zero_stream(void *dst, size_t n);
+
+#endif
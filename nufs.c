@@ -1,32 +1,126 @@
 // based on cs3650 starter code
 
+#define _GNU_SOURCE
 #include <assert.h>
 #include <bsd/string.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #define FUSE_USE_VERSION 26
 #include <fuse.h>
+
+#include "bgsched.h"
 #include "bitmap.h"
+#include "changelog.h"
 #include "inode.h"
 #include "directory.h"
+#include "hotblocks.h"
+#include "loop.h"
+#include "memops.h"
+#include "nufs_ioctl.h"
 #include "storage.h"
+#include "usage.h"
+#include "wcache.h"
+#include "super.h"
+
+// Mount options specific to nufs, given as -o name.
+typedef struct nufs_opts_t {
+  blocks_opts_t blocks;
+  int prefetch; // number of tasks prefetching hot blocks on mount
+  int itable_bg; // initialize the rest of the inode table in the background
+  int bg_threads; // number of threads running background maintenance
+  int write_combine; // buffer small sequential writes to open files
+  loop_opts_t loop;
+} nufs_opts_t;
+
+#define NUFS_OPT(templ, field) { templ, offsetof(nufs_opts_t, field), 1 }
+#define NUFS_OPT_VAL(templ, field) { templ, offsetof(nufs_opts_t, field), 0 }
+
+static const struct fuse_opt nufs_opt_spec[] = {
+  NUFS_OPT("hugepages", blocks.hugepages),
+  NUFS_OPT("in_memory", blocks.in_memory),
+  NUFS_OPT_VAL("window_blocks=%d", blocks.window_blocks),
+  NUFS_OPT_VAL("max_windows=%d", blocks.max_windows),
+  { "prefetch", offsetof(nufs_opts_t, prefetch), HOTBLOCKS_THREADS },
+  NUFS_OPT_VAL("prefetch=%d", prefetch),
+  NUFS_OPT("itable_bg", itable_bg),
+  NUFS_OPT_VAL("bg_threads=%d", bg_threads),
+  NUFS_OPT("write_combine", write_combine),
+  NUFS_OPT_VAL("workers=%d", loop.workers),
+  NUFS_OPT("clone_fd", loop.clone_fd),
+  NUFS_OPT_VAL("max_pending=%d", loop.max_pending),
+  NUFS_OPT_VAL("qos_iops=%d", loop.qos.iops),
+  NUFS_OPT_VAL("qos_bw=%d", loop.qos.bandwidth),
+  FUSE_OPT_END
+};
+
+nufs_opts_t nufs_opts;
+
+// serializes changes to the file system with all other requests, while
+// requests that only read from it run concurrently.
+static pthread_rwlock_t nufs_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Gets the inode of a file, using the handle of the open file if
+// there is one so the path need not be resolved again.
+inode_t *nufs_file_inode(const char *path, struct fuse_file_info *fi) {
+  if (NULL != fi && 0 != fi->fh) {
+    return get_inode(fi->fh);
+  }
+  return path_get_inode(path);
+}
+
+// Writes out the combined writes of the file at the given path, so a
+// request by path sees them.
+int nufs_flush_path(const char *path) {
+  if (!wcache_dirty()) {
+    return 0;
+  }
+  pthread_rwlock_rdlock(&nufs_lock);
+  inode_t *node = path_get_inode(path);
+  int inum = NULL == node ? 0 : node->inum;
+  pthread_rwlock_unlock(&nufs_lock);
+  return 0 == inum ? 0 : wcache_flush(inum);
+}
+
+// Writes to a file and records the change.
+// NOTE: Assumes the file system is locked for writing.
+static int nufs_write_inode(inode_t *node, const char *buf, size_t size, off_t offset) {
+  int rv = inode_write(node, buf, offset, size);
+  if (0 < rv) {
+    changelog_add(NUFS_CHANGE_WRITE, node->inum, node->parent, NULL);
+  }
+  return rv;
+}
+
+// Writes combined writes out to an inode.
+int nufs_apply_write(int inum, const char *buf, size_t size, off_t offset) {
+  pthread_rwlock_wrlock(&nufs_lock);
+  int rv = nufs_write_inode(get_inode(inum), buf, size, offset);
+  pthread_rwlock_unlock(&nufs_lock);
+  return rv;
+}
 
 // implementation for: man 2 access
 // Checks if a file exists.
 int nufs_access(const char *path, int mask) {
   int rv;
 
+  pthread_rwlock_rdlock(&nufs_lock);
   if (storage_access(path)) {
     rv = 0;
   } else {
     rv = -ENOENT;
   }
+  pthread_rwlock_unlock(&nufs_lock);
 
   printf("access(%s, %04o) -> %d\n", path, mask, rv);
   return rv;
@@ -38,36 +132,74 @@ int nufs_access(const char *path, int mask) {
 int nufs_getattr(const char *path, struct stat *st) {
   int rv;
 
+  nufs_flush_path(path);
+  pthread_rwlock_rdlock(&nufs_lock);
   if (0 == storage_stat(path, st)) {
     rv = 0;
   } else {
     rv = -ENOENT;
   }
+  pthread_rwlock_unlock(&nufs_lock);
 
   printf("getattr(%s) -> (%d) {mode: %04o, size: %ld}\n", path, rv, st->st_mode,
          st->st_size);
   return rv;
 }
 
+// Gets the attributes of an open file from its handle.
+int nufs_fgetattr(const char *path, struct stat *st,
+                  struct fuse_file_info *fi) {
+  if (wcache_dirty()) {
+    wcache_flush(fi->fh);
+  }
+  pthread_rwlock_rdlock(&nufs_lock);
+  int rv = inode_stat(nufs_file_inode(path, fi), st) ? -ENOENT : 0;
+  pthread_rwlock_unlock(&nufs_lock);
+  printf("fgetattr(%s) -> %d\n", path, rv);
+  return rv;
+}
+
+// Buffer and filler of a readdir call, passed to nufs_readdir_entry.
+typedef struct nufs_readdir_t {
+  void *buf;
+  fuse_fill_dir_t filler;
+} nufs_readdir_t;
+
+// Hands a directory entry to the filler, stopping once its buffer is full.
+static int nufs_readdir_entry(const dirent_t *dirent, int next, void *ctx) {
+  nufs_readdir_t *rd = ctx;
+  struct stat st;
+  char name[DIR_NAME_LENGTH + 1];
+  memcpy(name, dirent->name, DIR_NAME_LENGTH);
+  name[DIR_NAME_LENGTH] = '\0';
+  inode_stat(get_inode(dirent->inum), &st);
+  return rd->filler(rd->buf, name, &st, next);
+}
+
 // implementation for: man 2 readdir
-// lists the contents of a directory
+// lists the contents of a directory, filling the buffer with as many
+// entries as fit from the given offset on.
 int nufs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
                  off_t offset, struct fuse_file_info *fi) {
-  struct stat st;
-  dirent_t dirent;
-  int rv;
+  nufs_readdir_t rd = {buf, filler};
+  int rv = 0;
 
-  inode_t* di = path_get_inode(path);
-  if (0 != directory_read(di, &dirent, offset)) {
-    return 0;
+  // entries report sizes from the inodes, so buffered writes must land
+  // first, as for getattr.
+  if (wcache_dirty()) {
+    wcache_flush_all();
   }
-  inode_stat(get_inode(dirent.inum), &st);
-  if (0 != filler(buf, dirent.name, &st, offset + 1)) {
-    return 0;
+  pthread_rwlock_rdlock(&nufs_lock);
+  inode_t* di = path_get_inode(path);
+  if (NULL == di) {
+    rv = -ENOENT;
+  } else {
+    directory_iterate(di, offset, nufs_readdir_entry, &rd);
   }
+  pthread_rwlock_unlock(&nufs_lock);
 
   printf("readdir(%s) -> %d\n", path, rv);
-  return 0;
+  return rv;
 }
 
 // mknod makes a filesystem object like a file or directory
@@ -75,11 +207,32 @@ int nufs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 // Note, for this assignment, you can alternatively implement the create
 // function.
 int nufs_mknod(const char *path, mode_t mode, dev_t rdev) {
+  pthread_rwlock_wrlock(&nufs_lock);
   int rv = storage_mknod(path, mode);
+  pthread_rwlock_unlock(&nufs_lock);
   printf("mknod(%s, %04o) -> %d\n", path, mode, rv);
   return rv;
 }
 
+// Creates and opens a file in one go, instead of a mknod followed by
+// an open that would each resolve the path again.
+// implementation for: man 2 open (with O_CREAT)
+int nufs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+  pthread_rwlock_wrlock(&nufs_lock);
+  int inum = storage_create(path, mode);
+  pthread_rwlock_unlock(&nufs_lock);
+  int rv = inum < 0 ? inum : 0;
+  if (0 == rv) {
+    fi->fh = inum;
+    wcache_open(inum);
+    if (fi->flags & O_DIRECT) {
+      fi->direct_io = 1;
+    }
+  }
+  printf("create(%s, %04o) -> %d\n", path, mode, rv);
+  return rv;
+}
+
 // most of the following callbacks implement
 // another system call; see section 2 of the manual
 int nufs_mkdir(const char *path, mode_t mode) {
@@ -89,8 +242,10 @@ int nufs_mkdir(const char *path, mode_t mode) {
 }
 
 int nufs_unlink(const char *path) {
-  inode_t *node = path_get_inode(path);
+  nufs_flush_path(path);
+  pthread_rwlock_wrlock(&nufs_lock);
   int rv = storage_unlink(path);
+  pthread_rwlock_unlock(&nufs_lock);
   printf("unlink(%s) -> %d\n", path, rv);
   return rv;
 }
@@ -102,7 +257,9 @@ int nufs_link(const char *from, const char *to) {
 }
 
 int nufs_rmdir(const char *path) {
+  pthread_rwlock_wrlock(&nufs_lock);
   int rv = storage_rmdir(path);
+  pthread_rwlock_unlock(&nufs_lock);
   printf("rmdir(%s) -> %d\n", path, rv);
   return rv;
 }
@@ -110,7 +267,11 @@ int nufs_rmdir(const char *path) {
 // implements: man 2 rename
 // called to move a file within the same filesystem
 int nufs_rename(const char *from, const char *to) {
+  nufs_flush_path(from);
+  nufs_flush_path(to);
+  pthread_rwlock_wrlock(&nufs_lock);
   int rv = storage_rename(from, to);
+  pthread_rwlock_unlock(&nufs_lock);
   printf("rename(%s => %s) -> %d\n", from, to, rv);
   return rv;
 }
@@ -122,7 +283,10 @@ int nufs_chmod(const char *path, mode_t mode) {
 }
 
 int nufs_truncate(const char *path, off_t size) {
+  nufs_flush_path(path);
+  pthread_rwlock_wrlock(&nufs_lock);
   int rv = storage_truncate(path, size);
+  pthread_rwlock_unlock(&nufs_lock);
   printf("truncate(%s, %ld bytes) -> %d\n", path, size, rv);
   return rv;
 }
@@ -132,15 +296,59 @@ int nufs_truncate(const char *path, off_t size) {
 // open files.
 // You can just check whether the file is accessible.
 int nufs_open(const char *path, struct fuse_file_info *fi) {
-  int rv = !storage_access(path);
+  pthread_rwlock_rdlock(&nufs_lock);
+  inode_t *node = path_get_inode(path);
+  int rv = NULL == node;
+  // keeps the inode number as file handle for later calls.
+  if (NULL != node) {
+    fi->fh = node->inum;
+  }
+  pthread_rwlock_unlock(&nufs_lock);
+  if (0 == rv) {
+    wcache_open(fi->fh);
+  }
+  // bypasses the page cache so file data is only cached once, in the
+  // pages of the image mapping; reads copy straight out of it. The
+  // whole mount can use direct I/O with the FUSE option -o direct_io.
+  if (fi->flags & O_DIRECT) {
+    fi->direct_io = 1;
+  }
   printf("open(%s) -> %d\n", path, rv);
   return rv;
 }
 
+// Flushes the file to stable storage.
+int nufs_fsync(const char *path, int datasync, struct fuse_file_info *fi) {
+  int rv = wcache_flush(fi->fh);
+  blocks_sync();
+  printf("fsync(%s, %d) -> %d\n", path, datasync, rv);
+  return rv;
+}
+
+// Called on every close of a file descriptor; writes out combined
+// writes so close reports errors writing them.
+int nufs_flush(const char *path, struct fuse_file_info *fi) {
+  int rv = wcache_flush(fi->fh);
+  printf("flush(%s) -> %d\n", path, rv);
+  return rv;
+}
+
+// Called when the last descriptor of an open file is closed.
+int nufs_release(const char *path, struct fuse_file_info *fi) {
+  int rv = wcache_release(fi->fh);
+  printf("release(%s) -> %d\n", path, rv);
+  return rv;
+}
+
 // Actually read data
 int nufs_read(const char *path, char *buf, size_t size, off_t offset,
               struct fuse_file_info *fi) {
-  int rv = storage_read(path, buf, size, offset);
+  if (wcache_dirty()) {
+    wcache_flush(fi->fh);
+  }
+  pthread_rwlock_rdlock(&nufs_lock);
+  int rv = inode_read(nufs_file_inode(path, fi), buf, offset, size);
+  pthread_rwlock_unlock(&nufs_lock);
   printf("read(%s, %ld bytes, @+%ld) -> %d\n", path, size, offset, rv);
   return rv;
 }
@@ -148,7 +356,13 @@ int nufs_read(const char *path, char *buf, size_t size, off_t offset,
 // Actually write data
 int nufs_write(const char *path, const char *buf, size_t size, off_t offset,
                struct fuse_file_info *fi) {
-  int rv = storage_write(path,buf, size, offset);
+  // small appends are combined in the file's buffer; direct I/O is not.
+  int rv = fi->direct_io ? wcache_flush(fi->fh) : wcache_write(fi->fh, buf, size, offset);
+  if (0 == rv) {
+    pthread_rwlock_wrlock(&nufs_lock);
+    rv = nufs_write_inode(nufs_file_inode(path, fi), buf, size, offset);
+    pthread_rwlock_unlock(&nufs_lock);
+  }
   printf("write(%s, %ld bytes, @+%ld) -> %d\n", path, size, offset, rv);
   return rv;
 }
@@ -161,21 +375,185 @@ int nufs_utimens(const char *path, const struct timespec ts[2]) {
   return rv;
 }
 
-// Extended operations
+// Gets file system statistics from the counters in the superblock.
+// Implementation for: man 2 statfs
+int nufs_statfs(const char *path, struct statvfs *st) {
+  super_t *sb = get_super();
+  memset(st, 0, sizeof(struct statvfs));
+  st->f_bsize = BLOCK_SIZE;
+  st->f_frsize = BLOCK_SIZE;
+  st->f_blocks = BLOCK_COUNT;
+  st->f_bfree = sb->free_blocks;
+  st->f_bavail = sb->free_blocks;
+  st->f_files = INODE_COUNT;
+  st->f_ffree = sb->free_inodes;
+  st->f_favail = sb->free_inodes;
+  st->f_namemax = DIR_NAME_LENGTH - 1;
+  printf("statfs(%s) -> 0\n", path);
+  return 0;
+}
+
+// Fills a batch of stat records from the inode table, in inode order.
+static void nufs_bulkstat(nufs_bulkstat_t *bs) {
+  int inum = bs->cursor < (uint32_t) INODE_COUNT ? (int) bs->cursor : INODE_COUNT;
+  bs->count = 0;
+  while (bs->count < NUFS_BULKSTAT_BATCH && -1 != (inum = inode_next(inum))) {
+    inode_t *node = get_inode(inum);
+    nufs_bstat_t *st = &bs->stats[bs->count++];
+    st->ino = inum;
+    st->mode = node->mode;
+    st->nlink = node->links;
+    st->size = node->size;
+    st->blocks = bytes_to_blocks(node->size);
+    ++inum;
+  }
+  bs->cursor = -1 == inum ? 0 : inum;
+}
+
+// Fills a batch of changes from the journal.
+static void nufs_changes(nufs_changes_t *ch) {
+  ch->count = changelog_read(ch->cursor, ch->changes, NUFS_CHANGES_BATCH, &ch->first);
+  if (ch->cursor < ch->first) {
+    ch->cursor = ch->first;
+  }
+  ch->cursor += ch->count;
+}
+
+// Looks up the path of an inode from its parent pointers.
+static int nufs_inum_path(nufs_inum_path_t *ip) {
+  int rv = 0;
+  pthread_rwlock_rdlock(&nufs_lock);
+  inode_t *node = ip->ino < (uint32_t) INODE_COUNT ? get_inode(ip->ino) : NULL;
+  if (!inode_valid(node) || -1 == directory_path(node->inum, ip->path, NUFS_PATH_MAX)) {
+    rv = -ENOENT;
+  }
+  pthread_rwlock_unlock(&nufs_lock);
+  return rv;
+}
+
+// Gets an extended attribute. The only one is NUFS_XATTR_DU, the usage
+// of a file or directory tree as "<bytes> <blocks> <inodes>".
+// Implementation for: man 2 getxattr
+int nufs_getxattr(const char *path, const char *name, char *value, size_t size) {
+  char du[64];
+  usage_t usage;
+  int rv;
+
+  if (0 != strcmp(name, NUFS_XATTR_DU)) {
+    printf("getxattr(%s, %s) -> %d\n", path, name, -ENODATA);
+    return -ENODATA;
+  }
+  // sizes have to include buffered writes.
+  if (wcache_dirty()) {
+    wcache_flush_all();
+  }
+  pthread_rwlock_rdlock(&nufs_lock);
+  rv = usage_get(path_get_inode(path), &usage) ? -ENOENT : 0;
+  pthread_rwlock_unlock(&nufs_lock);
+  if (0 == rv) {
+    rv = snprintf(du, sizeof(du), "%d %d %d", usage.bytes, usage.blocks, usage.inodes);
+    if (0 != size && size < (size_t) rv) {
+      rv = -ERANGE;
+    } else if (0 != size) {
+      memcpy(value, du, rv);
+    }
+  }
+  printf("getxattr(%s, %s) -> %d\n", path, name, rv);
+  return rv;
+}
+
+// Lists the extended attributes of a file.
+// Implementation for: man 2 listxattr
+int nufs_listxattr(const char *path, char *list, size_t size) {
+  int rv = sizeof(NUFS_XATTR_DU);
+  if (0 != size && size < (size_t) rv) {
+    rv = -ERANGE;
+  } else if (0 != size) {
+    memcpy(list, NUFS_XATTR_DU, rv);
+  }
+  printf("listxattr(%s) -> %d\n", path, rv);
+  return rv;
+}
+
+// Extended operations, see nufs_ioctl.h
 int nufs_ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi,
                unsigned int flags, void *data) {
-  int rv = -1;
+  int rv = 0;
+  switch ((unsigned int) cmd) {
+  case NUFS_IOC_BULKSTAT:
+    // sizes have to include buffered writes.
+    if (wcache_dirty()) {
+      wcache_flush_all();
+    }
+    pthread_rwlock_rdlock(&nufs_lock);
+    nufs_bulkstat(data);
+    pthread_rwlock_unlock(&nufs_lock);
+    break;
+  case NUFS_IOC_INUM_PATH:
+    rv = nufs_inum_path(data);
+    break;
+  case NUFS_IOC_CHANGES:
+    pthread_rwlock_rdlock(&nufs_lock);
+    nufs_changes(data);
+    pthread_rwlock_unlock(&nufs_lock);
+    break;
+  case NUFS_IOC_CHANGES_CLEAR:
+    pthread_rwlock_wrlock(&nufs_lock);
+    changelog_clear(*(uint64_t *) data);
+    pthread_rwlock_unlock(&nufs_lock);
+    break;
+  default:
+    rv = -ENOTTY;
+  }
   printf("ioctl(%s, %d, ...) -> %d\n", path, cmd, rv);
   return rv;
 }
 
+// Negotiates capabilities with the kernel when mounting.
+// Background work starts here rather than in main, since FUSE may fork
+// into the background after main has set up the image.
+void *nufs_init(struct fuse_conn_info *conn) {
+  bgsched_init(0 < nufs_opts.bg_threads ? nufs_opts.bg_threads : BGSCHED_THREADS);
+  if (0 < nufs_opts.prefetch) {
+    hotblocks_prefetch(nufs_opts.prefetch);
+  }
+  if (nufs_opts.itable_bg) {
+    inode_table_init_background();
+  }
+  if (nufs_opts.write_combine) {
+    wcache_init(nufs_apply_write);
+    bgsched_submit(BGSCHED_PROMPT, WCACHE_FLUSH_HZ, wcache_timer_step, NULL, NULL);
+  }
+
+  // lets the kernel send writes larger than a page.
+  conn->want |= FUSE_CAP_BIG_WRITES;
+  // the ioctls also work on directories, which the kernel only passes
+  // on when asked to.
+  if (conn->capable & FUSE_CAP_IOCTL_DIR) {
+    conn->want |= FUSE_CAP_IOCTL_DIR;
+  }
+  return NULL;
+}
+
+// Called on unmount; stops background work, writes out combined writes,
+// saves the usage totals and the hot block list, marks the file system clean and closes the
+// image.
+void nufs_destroy(void *private_data) {
+  bgsched_stop();
+  wcache_flush_all();
+  hotblocks_save();
+  storage_unmount();
+  printf("destroy()\n");
+}
+
 void nufs_init_ops(struct fuse_operations *ops) {
   memset(ops, 0, sizeof(struct fuse_operations));
   ops->access = nufs_access;
   ops->getattr = nufs_getattr;
+  ops->fgetattr = nufs_fgetattr;
   ops->readdir = nufs_readdir;
   ops->mknod = nufs_mknod;
-  // ops->create   = nufs_create; // alternative to mknod
+  ops->create = nufs_create;
   ops->mkdir = nufs_mkdir;
   ops->link = nufs_link;
   ops->unlink = nufs_unlink;
@@ -187,21 +565,48 @@ void nufs_init_ops(struct fuse_operations *ops) {
   ops->read = nufs_read;
   ops->write = nufs_write;
   ops->utimens = nufs_utimens;
+  ops->statfs = nufs_statfs;
+  ops->getxattr = nufs_getxattr;
+  ops->listxattr = nufs_listxattr;
   ops->ioctl = nufs_ioctl;
+  ops->fsync = nufs_fsync;
+  ops->flush = nufs_flush;
+  ops->release = nufs_release;
+  ops->init = nufs_init;
+  ops->destroy = nufs_destroy;
 };
 
 struct fuse_operations nufs_ops;
 
 int main(int argc, char *argv[]) {
-  assert(argc > 2 && argc < 6);
+  assert(argc > 2);
   printf("TODO: mount %s as data file\n", argv[--argc]);
-  assert(BLOCK_BITMAP_SIZE + INODE_BITMAP_SIZE <= BLOCK_SIZE);
+  assert(BLOCK_BITMAP_SIZE + INODE_BITMAP_SIZE + sizeof(super_t) <= (size_t) BLOCK_SIZE);
+
+  // takes out the nufs options and passes the rest on to FUSE.
+  struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+  if (-1 == fuse_opt_parse(&args, &nufs_opts, nufs_opt_spec, NULL)) {
+    return 1;
+  }
 
-  blocks_init(argv[argc]);
-  inode_init();
-  directory_init();
+  memops_init();
+  storage_mount(argv[argc], &nufs_opts.blocks);
+  if (!nufs_opts.blocks.in_memory) {
+    hotblocks_init(argv[argc]);
+  }
 
   nufs_init_ops(&nufs_ops);
-  return fuse_main(argc, argv, &nufs_ops, NULL);
+  char *mountpoint;
+  int multithreaded;
+  struct fuse *fuse = fuse_setup(args.argc, args.argv, &nufs_ops,
+                                 sizeof(nufs_ops), &mountpoint,
+                                 &multithreaded, NULL);
+  fuse_opt_free_args(&args);
+  if (NULL == fuse) {
+    return 1;
+  }
+  // serves requests with our own loop unless asked to be single threaded.
+  int rv = multithreaded ? loop_run(fuse, &nufs_opts.loop) : fuse_loop(fuse);
+  fuse_teardown(fuse, mountpoint);
+  return -1 == rv ? 1 : 0;
 }
-
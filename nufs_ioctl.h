@@ -0,0 +1,108 @@
+/**
+ * @file nufs_ioctl.h
+ *
+ * ioctl commands and extended attributes understood by nufs, for tools
+ * working on a mounted file system. The commands can be issued on any
+ * file or directory opened in it. Every command takes a fixed-size structure, since FUSE passes
+ * ioctl data by the size encoded in the command.
+ */
+#ifndef NUFS_IOCTL_H
+#define NUFS_IOCTL_H
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+#define NUFS_IOCTL_MAGIC 'N'
+
+// Extended attribute with the usage of a file, or of a directory and
+// everything under it, as "<bytes> <blocks> <inodes>" in decimal.
+#define NUFS_XATTR_DU "user.nufs.du"
+
+#define NUFS_BULKSTAT_BATCH 64 // stat records returned by one bulkstat
+#define NUFS_PATH_MAX 4096      // size of a path buffer, with the terminator
+#define NUFS_NAME_MAX 48        // size of a name buffer, with the terminator
+#define NUFS_CHANGES_BATCH 32   // changes returned by one read of the journal
+
+// Attributes of an allocated inode, as returned by bulkstat.
+typedef struct nufs_bstat_t {
+  uint32_t ino;    // inode number
+  uint32_t mode;   // permission & type
+  uint32_t nlink;  // hard-link count
+  uint32_t size;   // bytes
+  uint32_t blocks; // blocks of BLOCK_SIZE holding the data
+} nufs_bstat_t;
+
+// A batch of inodes, in inode number order.
+typedef struct nufs_bulkstat_t {
+  uint32_t cursor; // in: inode number to start at, 0 for the first
+                   // out: inode number to continue at, 0 when done
+  uint32_t count;  // out: number of records filled in
+  nufs_bstat_t stats[NUFS_BULKSTAT_BATCH];
+} nufs_bulkstat_t;
+
+/**
+ * Returns the attributes of up to NUFS_BULKSTAT_BATCH allocated
+ * inodes from the cursor on, reading the inode table in order rather
+ * than walking the tree. Loop until the cursor comes back as 0.
+ */
+#define NUFS_IOC_BULKSTAT _IOWR(NUFS_IOCTL_MAGIC, 1, nufs_bulkstat_t)
+
+// The path of an inode.
+typedef struct nufs_inum_path_t {
+  uint32_t ino;              // in: inode number
+  char path[NUFS_PATH_MAX];  // out: its path from the root of the mount
+} nufs_inum_path_t;
+
+/**
+ * Gets the path of an inode from the parent pointers stored in it and
+ * the directories above it. Fails with ENOENT if the inode is free or
+ * its path is not known, e.g. after removing the hard link it was last
+ * linked by, or does not fit in NUFS_PATH_MAX bytes.
+ */
+#define NUFS_IOC_INUM_PATH _IOWR(NUFS_IOCTL_MAGIC, 2, nufs_inum_path_t)
+
+// Kinds of changes recorded in the change journal.
+#define NUFS_CHANGE_CREATE 1      // name created in parent
+#define NUFS_CHANGE_WRITE 2       // file written; one record for a run of writes
+#define NUFS_CHANGE_TRUNCATE 3    // file size set
+#define NUFS_CHANGE_UNLINK 4      // name removed from parent
+#define NUFS_CHANGE_RENAME_FROM 5 // old name of a rename, followed by
+#define NUFS_CHANGE_RENAME_TO 6   // its new name
+
+// A change to the file system. The journal stores these as they are.
+typedef struct nufs_change_t {
+  uint64_t seq;                // sequence number, counting up from 1
+  uint32_t op;                 // NUFS_CHANGE_*
+  uint32_t ino;                // inode changed
+  uint32_t parent;             // directory of the name, or the inode's
+                               // parent for writes and truncates
+  char name[NUFS_NAME_MAX];    // name in parent, empty for writes and
+                               // truncates
+} nufs_change_t;
+
+// A batch of changes from the journal, in order.
+typedef struct nufs_changes_t {
+  uint64_t cursor; // in: sequence number to start at, 0 for the oldest
+                   // out: sequence number to continue at
+  uint64_t first;  // out: oldest sequence number still in the journal;
+                   // changes were lost if it is past the cursor given
+  uint32_t count;  // out: number of changes filled in
+  uint32_t _reserved;
+  nufs_change_t changes[NUFS_CHANGES_BATCH];
+} nufs_changes_t;
+
+/**
+ * Reads up to NUFS_CHANGES_BATCH changes from the cursor on. The
+ * journal is a ring kept in the image, so the oldest changes are
+ * overwritten once it is full; consumers that fall behind see it in
+ * the first sequence number and must rescan.
+ */
+#define NUFS_IOC_CHANGES _IOWR(NUFS_IOCTL_MAGIC, 3, nufs_changes_t)
+
+/**
+ * Drops the changes before the given sequence number, once they have
+ * been consumed.
+ */
+#define NUFS_IOC_CHANGES_CLEAR _IOW(NUFS_IOCTL_MAGIC, 4, uint64_t)
+
+#endif
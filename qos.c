@@ -0,0 +1,108 @@
+#include <linux/fuse.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "qos.h"
+#include "workpool.h"
+
+#define QOS_SECOND 1000000000ull
+
+// A client's token buckets, kept as the times they next run dry
+// (generic cell rate algorithm): a bucket holds a second of tokens, so
+// a request fits while that time is less than a second ahead.
+typedef struct qos_client_t {
+  uint32_t uid;
+  int used;
+  uint64_t ops_tat;   // theoretical arrival time for requests
+  uint64_t bytes_tat; // theoretical arrival time for bytes
+} qos_client_t;
+
+static qos_opts_t qos_opts = { 0, 0 };
+static pthread_mutex_t qos_lock = PTHREAD_MUTEX_INITIALIZER;
+static qos_client_t qos_clients[QOS_CLIENTS];
+static qos_client_t qos_overflow; // shared once the table is full
+
+// Sets the limits applied to each client.
+void qos_init(const qos_opts_t *opts) {
+  if (NULL != opts) {
+    qos_opts = *opts;
+  }
+  memset(qos_clients, 0, sizeof(qos_clients));
+  memset(&qos_overflow, 0, sizeof(qos_overflow));
+  if (0 < qos_opts.iops || 0 < qos_opts.bandwidth) {
+    printf("+ qos_init() -> %d iops, %d KiB/s per uid\n", qos_opts.iops, qos_opts.bandwidth);
+  }
+}
+
+// Finds the given uid's buckets, adding them if needed.
+// NOTE: qos_lock must be held.
+static qos_client_t *qos_client(uint32_t uid) {
+  unsigned int idx = (uid * 2654435761u) % QOS_CLIENTS;
+  for (int ii = 0; ii < QOS_CLIENTS; ++ii) {
+    qos_client_t *c = &qos_clients[(idx + ii) % QOS_CLIENTS];
+    if (!c->used) {
+      c->used = 1;
+      c->uid = uid;
+      return c;
+    }
+    if (uid == c->uid) {
+      return c;
+    }
+  }
+  return &qos_overflow;
+}
+
+// Charges the given cost to a bucket. Returns the time the request
+// fits in the bucket, or 0 if it fits now.
+static uint64_t qos_charge(uint64_t *tat, uint64_t now, uint64_t cost) {
+  // an idle bucket refills up to a second of tokens, no more.
+  uint64_t start = *tat < now ? now : *tat;
+  *tat = start + cost;
+  return *tat <= now + QOS_SECOND ? 0 : *tat - QOS_SECOND;
+}
+
+// Classifies a raw request and charges it to its uid's buckets.
+uint64_t qos_schedule(const char *buf, size_t len, int *priority) {
+  const struct fuse_in_header *in = (const struct fuse_in_header *) buf;
+  *priority = QOS_METADATA;
+  if (len < sizeof(struct fuse_in_header)) {
+    return 0;
+  }
+
+  // only reads and writes move data.
+  uint64_t bytes = 0;
+  const char *arg = buf + sizeof(struct fuse_in_header);
+  if (FUSE_READ == in->opcode && sizeof(*in) + sizeof(struct fuse_read_in) <= len) {
+    bytes = ((const struct fuse_read_in *) arg)->size;
+    *priority = QOS_BULK;
+  } else if (FUSE_WRITE == in->opcode && sizeof(*in) + sizeof(struct fuse_write_in) <= len) {
+    bytes = ((const struct fuse_write_in *) arg)->size;
+    *priority = QOS_BULK;
+  }
+
+  if (0 >= qos_opts.iops && 0 >= qos_opts.bandwidth) {
+    return 0;
+  }
+  // forgetting and interrupting must never wait behind the requests
+  // they refer to.
+  if (FUSE_FORGET == in->opcode || FUSE_BATCH_FORGET == in->opcode ||
+      FUSE_INTERRUPT == in->opcode) {
+    return 0;
+  }
+
+  uint64_t now = workpool_now();
+  uint64_t when = 0;
+  pthread_mutex_lock(&qos_lock);
+  qos_client_t *c = qos_client(in->uid);
+  if (0 < qos_opts.iops) {
+    when = qos_charge(&c->ops_tat, now, QOS_SECOND / qos_opts.iops);
+  }
+  if (0 < qos_opts.bandwidth && 0 < bytes) {
+    uint64_t cost = bytes * QOS_SECOND / (1024ull * qos_opts.bandwidth);
+    uint64_t bw_when = qos_charge(&c->bytes_tat, now, cost);
+    when = when < bw_when ? bw_when : when;
+  }
+  pthread_mutex_unlock(&qos_lock);
+  return when;
+}
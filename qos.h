@@ -0,0 +1,40 @@
+// Per-client request scheduling for the FUSE loop.
+#ifndef QOS_H
+#define QOS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define QOS_METADATA 0 // priority class of metadata requests
+#define QOS_BULK 1     // priority class of reads and writes
+#define QOS_CLIENTS 1024 // most clients tracked; the rest share a bucket
+
+// Limits applied to every client (uid) separately.
+typedef struct qos_opts_t {
+  int iops;      // requests per second per client (0 = no limit)
+  int bandwidth; // KiB read or written per second per client (0 = no limit)
+} qos_opts_t;
+
+/**
+ * Sets the limits applied to each client.
+ *
+ * @param opts Limits, or NULL for none.
+ */
+void qos_init(const qos_opts_t *opts);
+
+/**
+ * Classifies a raw request read from /dev/fuse and charges it to the
+ * calling uid's token buckets. Each bucket holds up to a second of
+ * requests or bytes; once a client runs out, its requests are held
+ * back until it has tokens again, while other clients go on.
+ *
+ * @param buf Request as read from the device.
+ * @param len Length of the request.
+ * @param priority Set to QOS_METADATA or QOS_BULK.
+ *
+ * @return Earliest time to process the request, from workpool_now,
+ *         or 0 for right away.
+ */
+uint64_t qos_schedule(const char *buf, size_t len, int *priority);
+
+#endif
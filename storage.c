@@ -1,15 +1,48 @@
+#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include "blocks.h"
+#include "cbt.h"
+#include "changelog.h"
 #include "directory.h"
 #include "inode.h"
 #include "slist.h"
+#include "storage.h"
+#include "super.h"
+#include "usage.h"
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #define MAX(a,b) (((a)>(b))?(a):(b))
 
+// Opens the given image and mounts the file system on it.
+int storage_mount(const char *image_path, const blocks_opts_t *opts) {
+  blocks_init_opts(image_path, opts);
+  // a clean mount trusts the persisted counters; otherwise they are
+  // rebuilt from the bitmaps.
+  int clean = super_mount();
+  inode_init();
+  directory_init();
+  if (!clean) {
+    super_recover();
+  }
+  // tracks changed blocks before anything else allocates or writes.
+  cbt_init(clean);
+  usage_init(clean);
+  changelog_init();
+  return clean;
+}
+
+// Saves the usage totals, marks the file system clean and closes the
+// image.
+void storage_unmount() {
+  usage_save();
+  super_unmount();
+  blocks_free();
+}
+
 // Checks if the file at the given path exists
 // in the file system.
 int storage_access(const char *path) {
@@ -58,6 +91,7 @@ int storage_truncate(const char *path, off_t size) {
       return -1;
     }
   }
+  changelog_add(NUFS_CHANGE_TRUNCATE, node->inum, node->parent, NULL);
   return 0;
 }
 
@@ -89,23 +123,38 @@ int path_split_strings(const char *path, char *path_to_dir, char *name) {
   return 0;
 }
 
-// Creates a new file at the given path.
-int storage_mknod(const char *path, int mode) {
+// Creates a new file at the given path, resolving its directory once,
+// and returns its inode number.
+int storage_create(const char *path, int mode) {
   int path_length = strlen(path) + 1;
   char path_to_dir[MAX(path_length, DIR_NAME_LENGTH)];
   char name[DIR_NAME_LENGTH];
   path_split_strings(path, path_to_dir, name);
 
+  inode_t *di = path_get_inode(path_to_dir);
+  if (!inode_valid(di)) {
+    return -ENOENT;
+  }
+  if (-1 != directory_lookup(di, name)) {
+    return -EEXIST;
+  }
   int inum = alloc_inode(mode);
   if (inum < 0) {
-    return -1;
+    return -ENOSPC;
   }
-  inode_t *di = path_get_inode(path_to_dir);
-
+  // the directory can only fail to take the entry when it can not grow.
   if (-1 == directory_put(di, name, inum)) {
-    return -1;
+    free_inode(inum);
+    return -ENOSPC;
   }
-  return 0;
+  changelog_add(NUFS_CHANGE_CREATE, inum, di->inum, name);
+  return inum;
+}
+
+// Creates a new file at the given path.
+int storage_mknod(const char *path, int mode) {
+  int inum = storage_create(path, mode);
+  return inum < 0 ? inum : 0;
 }
 
 // Unlinks / deletes the file at the specified path.
@@ -118,7 +167,12 @@ int storage_unlink(const char *path) {
   if (NULL == di) {
     return -1;
   }
-  return directory_delete(di, name);
+  int inum = directory_lookup(di, name);
+  if (-1 == directory_delete(di, name)) {
+    return -1;
+  }
+  changelog_add(NUFS_CHANGE_UNLINK, inum, di->inum, name);
+  return 0;
 }
 
 // Removes the given directory if and only if the
@@ -173,6 +227,8 @@ int storage_rename(const char *from, const char *to) {
   if (-1 == directory_delete(from_di, from_name)) {
     return -1;
   }
+  changelog_add(NUFS_CHANGE_RENAME_FROM, from_fi->inum, from_di->inum, from_name);
+  changelog_add(NUFS_CHANGE_RENAME_TO, from_fi->inum, to_di->inum, to_name);
   return 0;
 }
 
@@ -12,8 +12,27 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "blocks.h"
 #include "slist.h"
 
+/**
+ * Opens the given disk image and mounts the file system on it,
+ * recovering the counters if it was not unmounted cleanly, and starts
+ * tracking changed blocks, usage and the change log.
+ *
+ * @param image_path Path to the disk image file.
+ * @param opts Mapping options, or NULL for the defaults.
+ *
+ * @return 1 if the image was unmounted cleanly, 0 if not.
+ */
+int storage_mount(const char *image_path, const blocks_opts_t *opts);
+
+/**
+ * Saves the usage totals, marks the file system clean and closes the
+ * disk image.
+ */
+void storage_unmount(void);
+
 /**
  * Checks if the file at the given path exists in the file system.
  *
@@ -70,13 +89,27 @@ int storage_write(const char *path, const char *buf, size_t size, off_t offset);
  */
 int storage_truncate(const char *path, off_t size);
 
+/**
+ * Creates a new file at the given path with the given mode, like
+ * storage_mknod, and returns its inode number so it can be used as
+ * a file handle.
+ *
+ * @param path Path to create file at.
+ * @param mode Mode to set file to.
+ *
+ * @return Inode number of the new file, or -ENOENT if the directory
+ *         does not exist, -EEXIST if the name is taken, or -ENOSPC if
+ *         there is no free inode or room for the entry.
+ */
+int storage_create(const char *path, int mode);
+
 /**
  * Creates a new file at the given path with the given mode.
  *
  * @param path Path to create file at.
  * @param mode Mode to set file to.
  *
- * @return 0 on success, -1 on failure.
+ * @return 0 on success, or a negative errno as for storage_create.
  */
 int storage_mknod(const char *path, int mode);
 
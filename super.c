@@ -0,0 +1,82 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "bitmap.h"
+#include "blocks.h"
+#include "inode.h"
+#include "super.h"
+
+// Gets the superblock, stored right after the inode bitmap.
+super_t *get_super(void) {
+  uint8_t *block = blocks_get_block(0);
+  return (super_t *) (block + BLOCK_BITMAP_SIZE + INODE_BITMAP_SIZE);
+}
+
+// Loads the superblock on mount, formatting it if the image has none.
+int super_mount(void) {
+  super_t *sb = get_super();
+  int clean = SUPER_MAGIC == sb->magic && SUPER_CLEAN == sb->state;
+  if (SUPER_MAGIC != sb->magic) {
+    // a new image, or one from before the superblock existed. A new
+    // image has not even reserved inode 0, and its inode table is left
+    // to be zeroed lazily as inodes are allocated.
+    sb->itable_uninit = 0;
+    sb->parents_unset = 0;
+    sb->version = 1;
+    if (!bitmap_get(get_inode_bitmap(), 0)) {
+      assert(inode_table_blocks() <= 32);
+      sb->itable_uninit = (unsigned int) ((1ull << inode_table_blocks()) - 1);
+      sb->version = SUPER_VERSION;
+    }
+    sb->magic = SUPER_MAGIC;
+  }
+  if (1 == sb->version) {
+    // version 1 inodes had no parent pointers. The table is converted
+    // before the version changes on disk, and directory_init fills the
+    // pointers in from the tree. Converting may allocate blocks, so the
+    // counters must be right first.
+    super_recover();
+    inode_table_migrate(INODE_SIZE_V1);
+    blocks_sync();
+    sb->parents_unset = 1;
+    sb->version = SUPER_VERSION;
+  }
+  ++sb->mounts;
+  // marks the file system dirty on disk before changing anything else,
+  // so a crash is detected on the next mount.
+  sb->state = SUPER_DIRTY;
+  blocks_sync();
+  printf("+ super_mount() -> %s\n", clean ? "clean" : "dirty");
+  return clean;
+}
+
+// Counts the unset bits in the given bitmap.
+static int super_count_free(void *bm, int size) {
+  int count = 0;
+  for (int ii = 0; ii < size; ++ii) {
+    count += !bitmap_get(bm, ii);
+  }
+  return count;
+}
+
+// Recomputes the free counts from the bitmaps.
+void super_recover(void) {
+  super_t *sb = get_super();
+  sb->free_blocks = super_count_free(get_blocks_bitmap(), BLOCK_COUNT);
+  sb->free_inodes = super_count_free(get_inode_bitmap(), INODE_COUNT);
+  sb->block_cursor = 1;
+  sb->inode_cursor = 2;
+  printf("+ super_recover() -> %d free blocks, %d free inodes\n",
+         sb->free_blocks, sb->free_inodes);
+}
+
+// Flushes the image and marks the file system clean on disk.
+void super_unmount(void) {
+  super_t *sb = get_super();
+  // everything else must be on disk before the clean flag is.
+  blocks_sync();
+  sb->state = SUPER_CLEAN;
+  blocks_sync();
+  printf("+ super_unmount()\n");
+}
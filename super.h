@@ -0,0 +1,65 @@
+// Superblock holding the mount state and persisted allocator counters.
+#ifndef SUPER_H
+#define SUPER_H
+
+#include <stdint.h>
+
+#define SUPER_MAGIC 0x5346554e // "NUFS" in little endian
+#define SUPER_VERSION 2 // 1: 72 byte inodes without parent pointers
+
+#define SUPER_CLEAN 1 // unmounted cleanly, counters can be trusted
+#define SUPER_DIRTY 2 // mounted, or crashed while mounted
+
+#define SUPER_CHANGELOG_BLOCKS 4 // blocks in the change journal ring
+
+// The superblock is stored in block 0 right after the inode bitmap.
+typedef struct super_t {
+  unsigned int magic;  // SUPER_MAGIC once the image is formatted
+  int version;         // on-disk format version
+  int state;           // SUPER_CLEAN or SUPER_DIRTY
+  int free_blocks;     // number of free blocks
+  int free_inodes;     // number of free inodes
+  int block_cursor;    // block to start the next allocation search at
+  int inode_cursor;    // inode to start the next allocation search at
+  unsigned int mounts; // number of times the image was mounted
+  unsigned int itable_uninit; // inode table blocks not zeroed yet, one bit
+                              // per block (bit 0 is block 1)
+  int parents_unset;   // parent pointers must be set from the tree
+  int usage_block;     // block the usage totals are saved to, 0 if none
+  int usage_saved;     // the usage block is up to date
+  int changelog_blocks[SUPER_CHANGELOG_BLOCKS]; // change journal ring, 0 if none
+  uint64_t changelog_head; // sequence number of the next change
+  uint64_t changelog_tail; // sequence number of the oldest change kept
+  int cbt_block;           // block of per-block change epochs, 0 if none
+  uint32_t cbt_epoch;      // epoch of this mount, counting up from 1
+} super_t;
+
+/**
+ * Gets the superblock.
+ *
+ * @return Pointer to the superblock in block 0.
+ */
+super_t *get_super(void);
+
+/**
+ * Loads the superblock on mount, formatting it if the image has none,
+ * and marks the file system dirty on disk until super_unmount.
+ *
+ * @return 1 if the file system was unmounted cleanly and its counters
+ *         can be trusted, or 0 if super_recover must be called once
+ *         the inode table and root directory are set up.
+ */
+int super_mount(void);
+
+/**
+ * Recomputes the free counts from the bitmaps and resets the
+ * allocation cursors, after an unclean shutdown or on a new image.
+ */
+void super_recover(void);
+
+/**
+ * Flushes the image and marks the file system clean on disk.
+ */
+void super_unmount(void);
+
+#endif
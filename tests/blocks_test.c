@@ -1,17 +1,23 @@
 #include <stdio.h>
+#include <unistd.h>
 
 #include "bitmap.h"
 #include "blocks.h"
 
+#include "check.h"
+
 #define TEST_NAME "block_test.img"
 
 int main(int argc, char **argv) {
+  // allocates from a fresh image that has no superblock.
+  unlink(TEST_NAME);
   blocks_init(TEST_NAME);
 
   printf("Block bitmap at the beginning:\n");
   bitmap_print(get_blocks_bitmap(), BLOCK_COUNT);
 
   int block_num = alloc_block();
+  CHECK(0 < block_num);
 
   printf("Allocated block no. %d\n", block_num);
 
@@ -31,6 +37,7 @@ int main(int argc, char **argv) {
   putchar('\n');
 
   blocks_free();
+  unlink(TEST_NAME);
 
   return 0;
 }
@@ -0,0 +1,89 @@
+// Looks names up in directories whose Bloom filters have been grown,
+// added to and rebuilt by creates, deletes and renames, checking every
+// answer against what the directory holds.
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "directory.h"
+#include "inode.h"
+#include "storage.h"
+
+#include "check.h"
+
+#define TEST_NAME "bloom_test.img"
+#define NAMES 150 // more than the smallest filter is sized for
+
+// whether /d/nN exists.
+static int present[NAMES];
+
+// Checks every name the test uses, and names it never creates.
+static void check_lookups(void) {
+  inode_t *di = path_get_inode("/d");
+  char name[16];
+  for (int ii = 0; ii < NAMES; ++ii) {
+    snprintf(name, sizeof(name), "n%d", ii);
+    CHECK(present[ii] == (-1 != directory_lookup(di, name)));
+    snprintf(name, sizeof(name), "missing%d", ii);
+    CHECK(-1 == directory_lookup(di, name));
+  }
+}
+
+int main(int argc, char **argv) {
+  unlink(TEST_NAME);
+  storage_mount(TEST_NAME, NULL);
+
+  CHECK(0 == storage_mknod("/d", 040755));
+  CHECK(0 == storage_mknod("/e", 040755));
+  char path[32];
+  char to[32];
+  // builds the filter while the directory is small, then outgrows it.
+  check_lookups();
+  for (int ii = 0; ii < NAMES; ++ii) {
+    snprintf(path, sizeof(path), "/d/n%d", ii);
+    CHECK(0 == storage_mknod(path, 0100644));
+    present[ii] = 1;
+  }
+  check_lookups();
+
+  // deleted names stay in the filter until it is rebuilt, but must not
+  // be found either way.
+  for (int ii = 0; ii < NAMES; ii += 3) {
+    snprintf(path, sizeof(path), "/d/n%d", ii);
+    CHECK(0 == storage_unlink(path));
+    present[ii] = 0;
+    CHECK(NULL == path_get_inode(path));
+  }
+  check_lookups();
+
+  // renames within the directory and out of it.
+  for (int ii = 1; ii < NAMES; ii += 3) {
+    snprintf(path, sizeof(path), "/d/n%d", ii);
+    if (ii % 2) {
+      snprintf(to, sizeof(to), "/d/n%d", ii - 1);
+      present[ii - 1] = 1;
+    } else {
+      snprintf(to, sizeof(to), "/e/n%d", ii);
+    }
+    CHECK(0 == storage_rename(path, to));
+    present[ii] = 0;
+    CHECK(NULL == path_get_inode(path));
+    CHECK(NULL != path_get_inode(to));
+  }
+  check_lookups();
+
+  // deleting most names rebuilds the filter.
+  for (int ii = 0; ii < NAMES; ++ii) {
+    snprintf(path, sizeof(path), "/d/n%d", ii);
+    if (present[ii] && 10 < ii) {
+      CHECK(0 == storage_unlink(path));
+      present[ii] = 0;
+    }
+  }
+  check_lookups();
+
+  storage_unmount();
+  unlink(TEST_NAME);
+  fprintf(stderr, "bloom_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,118 @@
+// Writes to an image in a new epoch and checks that exactly the blocks
+// written are reported changed, then restores a copy of the image from
+// before with tools/nufs-cbt and compares the two.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blocks.h"
+#include "cbt.h"
+#include "directory.h"
+#include "inode.h"
+#include "storage.h"
+#include "super.h"
+
+#include "check.h"
+
+#define TEST_NAME "cbt_test.img"
+#define BASE_NAME "cbt_test.base.img"
+#define DELTA_NAME "cbt_test.delta"
+#define TRUNC_NAME "cbt_test.trunc"
+#define TOOL "../tools/nufs-cbt"
+
+static char data[3 * 4096];
+
+// Reads a whole file into a buffer, returning its size.
+static long slurp(const char *path, char **buf) {
+  FILE *fh = fopen(path, "r");
+  CHECK(NULL != fh);
+  fseek(fh, 0, SEEK_END);
+  long size = ftell(fh);
+  rewind(fh);
+  *buf = malloc(size);
+  CHECK(1 == fread(*buf, size, 1, fh));
+  fclose(fh);
+  return size;
+}
+
+int main(int argc, char **argv) {
+  unlink(TEST_NAME);
+  storage_mount(TEST_NAME, NULL);
+  memset(data, 'a', sizeof(data));
+  CHECK(0 == storage_mknod("/file", 0100644));
+  CHECK((int) sizeof(data) == storage_write("/file", data, sizeof(data), 0));
+  storage_unmount();
+  CHECK(0 == system("cp " TEST_NAME " " BASE_NAME));
+
+  // overwrites the middle block of the file and nothing else.
+  storage_mount(TEST_NAME, NULL);
+  super_t *sb = get_super();
+  uint32_t epoch = sb->cbt_epoch;
+  inode_t *node = path_get_inode("/file");
+  int written = node->direct[1];
+  memset(data, 'b', 4096);
+  CHECK(4096 == storage_write("/file", data, 4096, 4096));
+  int usage_block = sb->usage_block;
+  int cbt_block = sb->cbt_block;
+  storage_unmount();
+
+  blocks_init(TEST_NAME);
+  uint32_t *epochs = cbt_epochs();
+  CHECK(NULL != epochs);
+  for (int ii = 0; ii < BLOCK_COUNT; ++ii) {
+    // the superblock, inode table and epoch block always count, and the
+    // usage totals are saved on every unmount.
+    int expected = ii <= inode_table_blocks() || ii == cbt_block ||
+                   ii == usage_block || ii == written;
+    if (expected != (epoch <= epochs[ii])) {
+      fprintf(stderr, "block %d: epoch %u\n", ii, epochs[ii]);
+    }
+    CHECK(expected == (epoch <= epochs[ii]));
+  }
+  blocks_free();
+
+  // restores the image from the copy and the blocks changed since.
+  char cmd[256];
+  snprintf(cmd, sizeof(cmd), TOOL " export " TEST_NAME " %u " DELTA_NAME " 2> /dev/null",
+           epoch);
+  CHECK(0 == system(cmd));
+  char *image;
+  char *base;
+  char *before;
+  long size = slurp(BASE_NAME, &before);
+
+  // a truncated delta is refused before anything is written.
+  CHECK(0 == system("head -c 10000 " DELTA_NAME " > " TRUNC_NAME));
+  CHECK(0 != system(TOOL " apply " BASE_NAME " " TRUNC_NAME " 2> /dev/null"));
+  CHECK(size == slurp(BASE_NAME, &base));
+  CHECK(0 == memcmp(before, base, size));
+  free(base);
+  // so is an image that is not at the epoch the delta starts from.
+  CHECK(0 != system(TOOL " apply " TEST_NAME " " DELTA_NAME " 2> /dev/null"));
+
+  CHECK(0 == system(TOOL " apply " BASE_NAME " " DELTA_NAME " 2> /dev/null"));
+  CHECK(size == slurp(TEST_NAME, &image));
+  CHECK(size == slurp(BASE_NAME, &base));
+  CHECK(0 == memcmp(image, base, size));
+  free(image);
+  free(base);
+  free(before);
+  // a full backup applies to any image, but not to a mounted one.
+  CHECK(0 == system(TOOL " export " TEST_NAME " 1 " DELTA_NAME " 2> /dev/null"));
+  blocks_init(BASE_NAME);
+  super_mount();
+  blocks_free();
+  CHECK(0 != system(TOOL " apply " BASE_NAME " " DELTA_NAME " 2> /dev/null"));
+  blocks_init(BASE_NAME);
+  super_unmount();
+  blocks_free();
+  CHECK(0 == system(TOOL " apply " BASE_NAME " " DELTA_NAME " 2> /dev/null"));
+
+  unlink(TEST_NAME);
+  unlink(BASE_NAME);
+  unlink(DELTA_NAME);
+  unlink(TRUNC_NAME);
+  fprintf(stderr, "cbt_test: ok\n");
+  return 0;
+}
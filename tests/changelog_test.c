@@ -0,0 +1,89 @@
+// Reads the change journal while a file is being written, and checks
+// that writes after a read are not lost in a change already handed out.
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blocks.h"
+#include "changelog.h"
+#include "directory.h"
+#include "inode.h"
+#include "storage.h"
+#include "super.h"
+
+#include "check.h"
+
+#define TEST_NAME "changelog_test.img"
+
+static nufs_change_t changes[16];
+
+// Reads the changes from the given cursor on, moving it past them.
+static int read_changes(uint64_t *cursor) {
+  uint64_t first;
+  int count = changelog_read(*cursor, changes, 16, &first);
+  if (*cursor < first) {
+    *cursor = first;
+  }
+  *cursor += count;
+  return count;
+}
+
+// Writes to the given file the way nufs_write does.
+static void write_file(const char *path, const char *data) {
+  inode_t *node = path_get_inode(path);
+  CHECK((int) strlen(data) == storage_write(path, data, strlen(data), 0));
+  changelog_add(NUFS_CHANGE_WRITE, node->inum, node->parent, NULL);
+}
+
+int main(int argc, char **argv) {
+  unlink(TEST_NAME);
+  storage_mount(TEST_NAME, NULL);
+
+  uint64_t cursor = 0;
+  CHECK(0 == storage_mknod("/file", 0100644));
+  int inum = path_get_inode("/file")->inum;
+  write_file("/file", "one");
+  write_file("/file", "two");
+  // the create and one change for the run of writes.
+  CHECK(2 == read_changes(&cursor));
+  CHECK(NUFS_CHANGE_CREATE == changes[0].op);
+  CHECK(0 == strcmp(changes[0].name, "file"));
+  CHECK(NUFS_CHANGE_WRITE == changes[1].op);
+  CHECK((uint32_t) inum == changes[1].ino);
+
+  // a write after the read is a new change, not merged into the old one.
+  write_file("/file", "three");
+  write_file("/file", "four");
+  CHECK(1 == read_changes(&cursor));
+  CHECK(NUFS_CHANGE_WRITE == changes[0].op);
+  CHECK(changes[0].seq + 1 == cursor);
+
+  // clearing what was read leaves only the writes after it.
+  changelog_clear(cursor);
+  write_file("/file", "five");
+  uint64_t again = 0;
+  CHECK(1 == read_changes(&again));
+  CHECK(NUFS_CHANGE_WRITE == changes[0].op);
+  CHECK(again == cursor + 1);
+
+  // without room for the whole ring, the journal stays off and the
+  // blocks it did get are given back.
+  super_t *sb = get_super();
+  for (int ii = 0; ii < SUPER_CHANGELOG_BLOCKS; ++ii) {
+    free_block(sb->changelog_blocks[ii]);
+    sb->changelog_blocks[ii] = 0;
+  }
+  while (SUPER_CHANGELOG_BLOCKS - 1 < sb->free_blocks) {
+    CHECK(-1 != alloc_block());
+  }
+  changelog_init();
+  CHECK(SUPER_CHANGELOG_BLOCKS - 1 == sb->free_blocks);
+  for (int ii = 0; ii < SUPER_CHANGELOG_BLOCKS; ++ii) {
+    CHECK(0 == sb->changelog_blocks[ii]);
+  }
+
+  storage_unmount();
+  unlink(TEST_NAME);
+  fprintf(stderr, "changelog_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,19 @@
+// Helpers for the tests run by `make check`.
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Fails the test, saying where, unless the condition holds. Progress
+// messages of the file system go to stdout, so failures go to stderr.
+#define CHECK(cond)                                                        \
+  do {                                                                     \
+    if (!(cond)) {                                                         \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__,     \
+              #cond);                                                      \
+      exit(1);                                                             \
+    }                                                                      \
+  } while (0)
+
+#endif
@@ -0,0 +1,70 @@
+// Creates and deletes directory entries and checks the name hashes
+// stored in them, and that entries without one are still found.
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "directory.h"
+#include "inode.h"
+#include "storage.h"
+
+#include "check.h"
+
+#define TEST_NAME "dirent_hash_test.img"
+
+// Reads the dirent in the given slot of a directory.
+static dirent_t slot(inode_t *di, int idx) {
+  dirent_t dirent;
+  CHECK(DIRENT_SIZE == inode_read(di, (char *) &dirent, idx * DIRENT_SIZE, DIRENT_SIZE));
+  return dirent;
+}
+
+// Checks that the given slot holds the given name with its hash set.
+static void check_hashed(inode_t *di, int idx, const char *name) {
+  dirent_t dirent = slot(di, idx);
+  CHECK(0 == strcmp(dirent.name, name));
+  CHECK((uint32_t) directory_name_hash(name) == dirent.hash);
+  CHECK((dirent.hash ^ DIRENT_HASH_TAG) == dirent.hash_tag);
+}
+
+int main(int argc, char **argv) {
+  unlink(TEST_NAME);
+  storage_mount(TEST_NAME, NULL);
+
+  CHECK(0 == storage_mknod("/d", 040755));
+  CHECK(0 == storage_mknod("/d/one", 0100644));
+  CHECK(0 == storage_mknod("/d/two", 0100644));
+  CHECK(0 == storage_mknod("/d/three", 0100644));
+  inode_t *di = path_get_inode("/d");
+  check_hashed(di, 0, "one");
+  check_hashed(di, 1, "two");
+  check_hashed(di, 2, "three");
+
+  // a deleted entry has its hash and tag cleared with its name.
+  CHECK(0 == storage_unlink("/d/two"));
+  dirent_t dirent = slot(di, 1);
+  CHECK(0 == dirent.inum);
+  CHECK(0 == dirent.hash);
+  CHECK(0 == dirent.hash_tag);
+  CHECK(NULL == path_get_inode("/d/two"));
+  CHECK(NULL != path_get_inode("/d/three"));
+
+  // the freed slot is reused with the new name's hash.
+  CHECK(0 == storage_mknod("/d/four", 0100644));
+  check_hashed(di, 1, "four");
+
+  // an entry written before hashes were stored has no tag, and is
+  // compared by name.
+  dirent = slot(di, 2);
+  int inum = dirent.inum;
+  dirent.hash = 0;
+  dirent.hash_tag = 0;
+  CHECK(DIRENT_SIZE == inode_write(di, (char *) &dirent, 2 * DIRENT_SIZE, DIRENT_SIZE));
+  CHECK(inum == directory_lookup(di, "three"));
+  CHECK(-1 == directory_lookup(di, "five"));
+
+  storage_unmount();
+  unlink(TEST_NAME);
+  fprintf(stderr, "dirent_hash_test: ok\n");
+  return 0;
+}
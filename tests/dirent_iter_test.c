@@ -0,0 +1,73 @@
+// Scans a directory spanning several blocks in place, from the start
+// and from the middle, and compares what it sees with copied dirents.
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blocks.h"
+#include "directory.h"
+#include "inode.h"
+#include "storage.h"
+
+#include "check.h"
+
+#define TEST_NAME "dirent_iter_test.img"
+#define NAMES 150 // a little over two blocks of dirents
+
+// Scans the directory from the given dirent, checking every batch.
+static void check_scan(inode_t *di, int start) {
+  int per_block = BLOCK_SIZE / DIRENT_SIZE;
+  dirent_iter_t it;
+  const dirent_t *ents;
+  int idx, n;
+  int expected = start;
+  dirent_iter_start(&it, di, start);
+  while (NULL != (ents = dirent_iter_next(&it, &idx, &n))) {
+    // batches pick up where the last one ended and stop at the end of
+    // a block, holding it.
+    CHECK(expected == idx);
+    CHECK(0 < n && n <= per_block - idx % per_block);
+    CHECK(0 == (idx + n) % per_block || NAMES == idx + n);
+    CHECK(-1 != it.pinned);
+    for (int ii = 0; ii < n; ++ii) {
+      dirent_t copy;
+      CHECK(DIRENT_SIZE == inode_read(di, (char *) &copy, (idx + ii) * DIRENT_SIZE,
+                                      DIRENT_SIZE));
+      CHECK(0 == memcmp(&copy, &ents[ii], DIRENT_SIZE));
+    }
+    expected += n;
+  }
+  CHECK(NAMES == expected);
+  dirent_iter_stop(&it);
+  CHECK(-1 == it.pinned);
+  dirent_iter_stop(&it);
+}
+
+int main(int argc, char **argv) {
+  unlink(TEST_NAME);
+  storage_mount(TEST_NAME, NULL);
+
+  CHECK(0 == storage_mknod("/d", 040755));
+  char path[16];
+  for (int ii = 0; ii < NAMES; ++ii) {
+    snprintf(path, sizeof(path), "/d/n%d", ii);
+    CHECK(0 == storage_mknod(path, 0100644));
+  }
+  inode_t *di = path_get_inode("/d");
+  CHECK(NAMES * DIRENT_SIZE == di->size);
+  check_scan(di, 0);
+  check_scan(di, 70);
+  check_scan(di, NAMES - 1);
+
+  // a scan starting past the end hands out nothing.
+  dirent_iter_t it;
+  int idx, n;
+  dirent_iter_start(&it, di, NAMES);
+  CHECK(NULL == dirent_iter_next(&it, &idx, &n));
+  dirent_iter_stop(&it);
+
+  storage_unmount();
+  unlink(TEST_NAME);
+  fprintf(stderr, "dirent_iter_test: ok\n");
+  return 0;
+}
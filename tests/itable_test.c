@@ -0,0 +1,89 @@
+// Formats an image whose inode table holds garbage, and checks that
+// table blocks are only zeroed when first used or by the background
+// initializer.
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bgsched.h"
+#include "blocks.h"
+#include "directory.h"
+#include "inode.h"
+#include "storage.h"
+#include "super.h"
+
+#include "check.h"
+
+#define TEST_NAME "itable_test.img"
+#define GARBAGE 0x5a
+
+static char image[256][4096];
+
+// Checks if the given block still holds the garbage it was made with.
+static int is_garbage(int bnum) {
+  const unsigned char *block = blocks_get_block(bnum);
+  for (int ii = 0; ii < BLOCK_SIZE; ++ii) {
+    if (GARBAGE != block[ii]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  // an unformatted image with leftovers where the table will be.
+  for (int ii = 1; ii <= 5; ++ii) {
+    memset(image[ii], GARBAGE, sizeof(image[ii]));
+  }
+  FILE *fh = fopen(TEST_NAME, "w");
+  CHECK(NULL != fh);
+  CHECK(1 == fwrite(image, sizeof(image), 1, fh));
+  fclose(fh);
+
+  storage_mount(TEST_NAME, NULL);
+  super_t *sb = get_super();
+  int tblocks = inode_table_blocks();
+  // only the block holding the root inode has been zeroed.
+  CHECK(((1u << tblocks) - 1) - 1 == sb->itable_uninit);
+  for (int ii = 2; ii <= tblocks; ++ii) {
+    CHECK(is_garbage(ii));
+  }
+
+  // allocating an inode in the next block zeroes just that block.
+  int per_block = BLOCK_SIZE / INODE_SIZE;
+  char path[16];
+  int inum = 0;
+  for (int ii = 0; inum < per_block; ++ii) {
+    snprintf(path, sizeof(path), "/f%d", ii);
+    CHECK(0 == storage_mknod(path, 0100644));
+    inum = path_get_inode(path)->inum;
+  }
+  CHECK(0 == (sb->itable_uninit & 2));
+  CHECK(0 != (sb->itable_uninit & 4));
+  CHECK(is_garbage(3));
+  inode_t *node = get_inode(inum);
+  CHECK(0 == node->size);
+  CHECK(0 == node->indirect);
+  for (int ii = 0; ii < NDIRECT; ++ii) {
+    CHECK(0 == node->direct[ii]);
+  }
+  storage_unmount();
+
+  // the flags persist, and the background initializer zeroes the rest.
+  storage_mount(TEST_NAME, NULL);
+  sb = get_super();
+  CHECK(0 != (sb->itable_uninit & 4));
+  bgsched_init(1);
+  inode_table_init_background();
+  for (int ii = 0; ii < 100 && 0 != sb->itable_uninit; ++ii) {
+    usleep(10000);
+  }
+  bgsched_stop();
+  CHECK(0 == sb->itable_uninit);
+  CHECK(!is_garbage(tblocks));
+  storage_unmount();
+
+  unlink(TEST_NAME);
+  fprintf(stderr, "itable_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "memops.h"
+
+#include "check.h"
+
+#define SIZE (3 * MEMOPS_STREAM_THRESHOLD)
+
+static char src[SIZE + 64];
+static char dst[SIZE + 64];
+
+int main(int argc, char **argv) {
+  memops_init();
+
+  for (int i = 0; i < SIZE + 64; i++) {
+    src[i] = (char) (i * 31 + 7);
+  }
+
+  // copies at odd offsets so the kernels hit unaligned heads and tails.
+  memops_copy_t copy = memops_copy_for(SIZE);
+  copy(dst + 3, src + 5, SIZE - 11);
+  CHECK(0 == memcmp(dst + 3, src + 5, SIZE - 11));
+  // leaves the bytes on either side alone.
+  for (int i = 0; i < 3; i++) {
+    CHECK(0 == dst[i]);
+  }
+  for (int i = SIZE - 8; i < SIZE + 64; i++) {
+    CHECK(0 == dst[i]);
+  }
+
+  copy = memops_copy_for(100);
+  CHECK(memcpy == copy);
+  copy(dst, src + 1, 100);
+  CHECK(0 == memcmp(dst, src + 1, 100));
+
+  dst[SIZE - 1] = 1;
+  memops_zero_stream(dst + 1, SIZE - 2);
+  for (int i = 1; i < SIZE - 1; i++) {
+    CHECK(0 == dst[i]);
+  }
+  // leaves the bytes on either side alone.
+  CHECK(src[1] == dst[0]);
+  CHECK(1 == dst[SIZE - 1]);
+
+  fprintf(stderr, "memops_test: ok\n");
+  return 0;
+}
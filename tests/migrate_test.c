@@ -0,0 +1,118 @@
+// Mounts an image laid out the way the original nufs wrote it, with
+// 72 byte inodes and no superblock, and reads its files back.
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "directory.h"
+#include "inode.h"
+#include "storage.h"
+#include "super.h"
+
+#include "check.h"
+
+#define TEST_NAME "migrate_test.img"
+#define BIG_SIZE (15 * 4096 - 100) // uses the indirect block
+
+// An inode as the original nufs stored it.
+typedef struct inode_v1_t {
+  int inum;
+  int mode;
+  int refs;
+  int links;
+  int size;
+  int direct[NDIRECT];
+  int indirect;
+} inode_v1_t;
+
+// A directory entry as the original nufs stored it.
+typedef struct dirent_v1_t {
+  char name[DIR_NAME_LENGTH];
+  int inum;
+  char _reserved[12];
+} dirent_v1_t;
+
+static char image[256][4096];
+
+// Sets the given bit of a bitmap.
+static void set_bit(uint8_t *bm, int i) { bm[i / 8] |= 1 << (i % 8); }
+
+// Makes an inode using the given consecutive blocks.
+static void make_inode(int inum, int mode, int size, int first, int indirect) {
+  inode_v1_t *node = (inode_v1_t *) (image[1] + 72 * inum);
+  node->inum = inum;
+  node->mode = mode;
+  node->links = 1;
+  node->size = size;
+  int count = (size + 4095) / 4096;
+  for (int ii = 0; ii < count; ++ii) {
+    if (ii < NDIRECT) {
+      node->direct[ii] = first + ii;
+    } else {
+      ((int *) image[indirect])[ii - NDIRECT] = first + ii;
+    }
+  }
+  node->indirect = NDIRECT < count ? indirect : 0;
+  set_bit((uint8_t *) image[0] + 32, inum);
+  for (int ii = 0; ii < count; ++ii) {
+    set_bit((uint8_t *) image[0], first + ii);
+  }
+  if (NDIRECT < count) {
+    set_bit((uint8_t *) image[0], indirect);
+  }
+}
+
+// Adds an entry to a directory stored in one block.
+static void make_dirent(int bnum, int idx, const char *name, int inum) {
+  dirent_v1_t *dirent = (dirent_v1_t *) image[bnum] + idx;
+  strcpy(dirent->name, name);
+  dirent->inum = inum;
+}
+
+int main(int argc, char **argv) {
+  // the original nufs reserved blocks 1 to 4 for its table and gave out
+  // block 5, which the table now grows into, to the root directory.
+  for (int ii = 0; ii <= 4; ++ii) {
+    set_bit((uint8_t *) image[0], ii);
+  }
+  set_bit((uint8_t *) image[0] + 32, 0);
+  make_inode(1, 040755, 2 * sizeof(dirent_v1_t), 5, 0);
+  make_dirent(5, 0, "alpha", 2);
+  make_dirent(5, 1, "dir", 3);
+  make_inode(2, 0100644, 11, 6, 0);
+  memcpy(image[6], "alpha data\n", 11);
+  make_inode(3, 040755, sizeof(dirent_v1_t), 7, 0);
+  make_dirent(7, 0, "gamma", 4);
+  make_inode(4, 0100644, BIG_SIZE, 8, 30);
+  for (int ii = 0; ii < BIG_SIZE; ++ii) {
+    image[8 + ii / 4096][ii % 4096] = 'a' + ii % 26;
+  }
+  FILE *fh = fopen(TEST_NAME, "w");
+  CHECK(NULL != fh);
+  CHECK(1 == fwrite(image, sizeof(image), 1, fh));
+  fclose(fh);
+
+  storage_mount(TEST_NAME, NULL);
+  CHECK(SUPER_VERSION == get_super()->version);
+
+  char buf[BIG_SIZE];
+  CHECK(11 == storage_read("/alpha", buf, sizeof(buf), 0));
+  CHECK(0 == memcmp(buf, "alpha data\n", 11));
+  CHECK(BIG_SIZE == storage_read("/dir/gamma", buf, sizeof(buf), 0));
+  for (int ii = 0; ii < BIG_SIZE; ++ii) {
+    CHECK('a' + ii % 26 == buf[ii]);
+  }
+  // the root's entries were moved out of the way of the table.
+  CHECK(5 < get_inode(DIR_ROOT)->direct[0]);
+  char path[64];
+  CHECK(10 == directory_path(path_get_inode("/dir/gamma")->inum, path, sizeof(path)));
+  CHECK(0 == strcmp(path, "/dir/gamma"));
+  CHECK(0 == storage_mknod("/delta", 0100644));
+  CHECK(NULL != path_get_inode("/alpha"));
+
+  storage_unmount();
+  unlink(TEST_NAME);
+  fprintf(stderr, "migrate_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,90 @@
+// Lists a large directory a few entries at a time the way readdir does,
+// resuming each call from the offset of the last entry taken.
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "directory.h"
+#include "inode.h"
+#include "storage.h"
+
+#include "check.h"
+
+#define TEST_NAME "readdir_test.img"
+#define NAMES 200
+#define BATCH 7 // entries that fit in one call's buffer
+
+// A listing in progress, standing in for a readdir buffer.
+typedef struct listing_t {
+  int seen[NAMES]; // times each name was listed
+  int order;       // number of the last name listed, to check the order
+  int taken;       // entries taken in the current call
+  int offset;      // offset to resume from, as given to the filler
+} listing_t;
+
+// Takes an entry like a readdir filler, refusing it once the batch is
+// full.
+static int take_entry(const dirent_t *dirent, int next, void *ctx) {
+  listing_t *ls = ctx;
+  if (BATCH == ls->taken) {
+    return 1;
+  }
+  int num;
+  CHECK(1 == sscanf(dirent->name, "n%d", &num));
+  CHECK(ls->order < num);
+  ls->order = num;
+  ++ls->seen[num];
+  ++ls->taken;
+  ls->offset = next;
+  return 0;
+}
+
+// Lists one batch from the offset left by the last, returning whether
+// the listing is done.
+static int list_batch(inode_t *di, listing_t *ls) {
+  ls->taken = 0;
+  return -1 == directory_iterate(di, ls->offset, take_entry, ls);
+}
+
+int main(int argc, char **argv) {
+  unlink(TEST_NAME);
+  storage_mount(TEST_NAME, NULL);
+
+  CHECK(0 == storage_mknod("/d", 040755));
+  char path[16];
+  for (int ii = 0; ii < NAMES; ++ii) {
+    snprintf(path, sizeof(path), "/d/n%d", ii);
+    CHECK(0 == storage_mknod(path, 0100644));
+  }
+  // leaves holes for the listing to skip.
+  for (int ii = 5; ii < NAMES; ii += 10) {
+    snprintf(path, sizeof(path), "/d/n%d", ii);
+    CHECK(0 == storage_unlink(path));
+  }
+  inode_t *di = path_get_inode("/d");
+
+  listing_t ls;
+  memset(&ls, 0, sizeof(ls));
+  ls.order = -1;
+  int calls = 1;
+  for (; !list_batch(di, &ls); ++calls) {
+    CHECK(BATCH == ls.taken);
+    // deleting entries between calls neither repeats nor skips the
+    // ones still there.
+    if (3 == calls) {
+      CHECK(0 == storage_unlink("/d/n0"));
+      CHECK(0 == storage_unlink("/d/n150"));
+    }
+  }
+  CHECK(ls.taken <= BATCH);
+  for (int ii = 0; ii < NAMES; ++ii) {
+    int expected = 5 == ii % 10 || 150 == ii ? 0 : 1;
+    CHECK(expected == ls.seen[ii]);
+  }
+  CHECK((NAMES - NAMES / 10 - 1 + BATCH - 1) / BATCH == calls);
+
+  storage_unmount();
+  unlink(TEST_NAME);
+  fprintf(stderr, "readdir_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,90 @@
+// Checks that the superblock's clean flag and free counters persist
+// across a clean remount, and are recomputed after an unclean one, and
+// that running out of inodes fails creates with ENOSPC.
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "bitmap.h"
+#include "blocks.h"
+#include "inode.h"
+#include "storage.h"
+#include "super.h"
+
+#include "check.h"
+
+#define TEST_NAME "super_test.img"
+
+// Counts the unset bits in the given bitmap.
+static int count_free(void *bm, int size) {
+  int count = 0;
+  for (int ii = 0; ii < size; ++ii) {
+    count += !bitmap_get(bm, ii);
+  }
+  return count;
+}
+
+// Checks that the counters match the bitmaps.
+static void check_counters(void) {
+  super_t *sb = get_super();
+  CHECK(count_free(get_blocks_bitmap(), BLOCK_COUNT) == sb->free_blocks);
+  CHECK(count_free(get_inode_bitmap(), INODE_COUNT) == sb->free_inodes);
+}
+
+int main(int argc, char **argv) {
+  static char data[3 * 4096];
+  unlink(TEST_NAME);
+  CHECK(0 == storage_mount(TEST_NAME, NULL));
+  super_t *sb = get_super();
+  CHECK(SUPER_MAGIC == sb->magic);
+  CHECK(SUPER_DIRTY == sb->state);
+  check_counters();
+
+  // the counters follow allocations without a rescan.
+  CHECK(0 == storage_mknod("/file", 0100644));
+  CHECK((int) sizeof(data) == storage_write("/file", data, sizeof(data), 0));
+  CHECK(0 == storage_mknod("/gone", 0100644));
+  CHECK(0 == storage_unlink("/gone"));
+  check_counters();
+  int free_blocks = sb->free_blocks;
+  int free_inodes = sb->free_inodes;
+  unsigned int mounts = sb->mounts;
+  super_unmount();
+  CHECK(SUPER_CLEAN == sb->state);
+  blocks_free();
+
+  // a clean mount trusts the counters it finds.
+  CHECK(1 == storage_mount(TEST_NAME, NULL));
+  sb = get_super();
+  CHECK(SUPER_DIRTY == sb->state);
+  CHECK(mounts + 1 == sb->mounts);
+  CHECK(free_blocks == sb->free_blocks);
+  CHECK(free_inodes == sb->free_inodes);
+  // leaves the image dirty, with a counter that is off.
+  ++sb->free_blocks;
+  blocks_free();
+
+  // an unclean mount recomputes them from the bitmaps.
+  CHECK(0 == storage_mount(TEST_NAME, NULL));
+  sb = get_super();
+  CHECK(free_blocks == sb->free_blocks);
+  check_counters();
+
+  // failed creates say why, and leave the counters as they were.
+  CHECK(-EEXIST == storage_mknod("/file", 0100644));
+  CHECK(-ENOENT == storage_mknod("/none/file", 0100644));
+  CHECK(free_inodes == sb->free_inodes);
+  char path[16];
+  int rv = 0;
+  for (int ii = 0; 0 == rv; ++ii) {
+    snprintf(path, sizeof(path), "/f%d", ii);
+    rv = storage_mknod(path, 0100644);
+  }
+  CHECK(-ENOSPC == rv);
+  check_counters();
+  storage_unmount();
+
+  unlink(TEST_NAME);
+  fprintf(stderr, "super_test: ok\n");
+  return 0;
+}
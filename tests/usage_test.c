@@ -0,0 +1,76 @@
+// Checks the usage totals of a directory through create, write,
+// truncate and unlink, and that they survive clean and unclean
+// remounts.
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blocks.h"
+#include "directory.h"
+#include "inode.h"
+#include "storage.h"
+#include "usage.h"
+
+#include "check.h"
+
+#define TEST_NAME "usage_test.img"
+
+static char data[5000];
+
+// Checks the usage of the given path.
+static void check_usage(const char *path, int bytes, int blocks, int inodes) {
+  usage_t usage;
+  CHECK(0 == usage_get(path_get_inode(path), &usage));
+  if (bytes != usage.bytes || blocks != usage.blocks || inodes != usage.inodes) {
+    fprintf(stderr, "%s: %d %d %d, expected %d %d %d\n", path, usage.bytes,
+            usage.blocks, usage.inodes, bytes, blocks, inodes);
+  }
+  CHECK(bytes == usage.bytes);
+  CHECK(blocks == usage.blocks);
+  CHECK(inodes == usage.inodes);
+}
+
+int main(int argc, char **argv) {
+  unlink(TEST_NAME);
+  storage_mount(TEST_NAME, NULL);
+  usage_t root;
+  CHECK(0 == usage_get(path_get_inode("/"), &root));
+
+  CHECK(0 == storage_mknod("/d", 040755));
+  check_usage("/d", 0, 0, 1);
+  // the new name grows the directory by a dirent.
+  CHECK(0 == storage_mknod("/d/f", 0100644));
+  check_usage("/d/f", 0, 0, 1);
+  check_usage("/d", DIRENT_SIZE, 1, 2);
+  CHECK((int) sizeof(data) == storage_write("/d/f", data, sizeof(data), 0));
+  check_usage("/d/f", 5000, 2, 1);
+  check_usage("/d", DIRENT_SIZE + 5000, 3, 2);
+  CHECK(0 == storage_truncate("/d/f", 100));
+  check_usage("/d", DIRENT_SIZE + 100, 2, 2);
+  // the root counts everything under it, including its own new dirent.
+  check_usage("/", root.bytes + 2 * DIRENT_SIZE + 100, root.blocks + 3, root.inodes + 2);
+  CHECK(0 == storage_unlink("/d/f"));
+  check_usage("/d", DIRENT_SIZE, 1, 1);
+
+  // takes the freed dirent, so the directory does not grow.
+  CHECK(0 == storage_mknod("/d/g", 0100644));
+  CHECK(4096 == storage_write("/d/g", data, 4096, 0));
+  check_usage("/d", DIRENT_SIZE + 4096, 2, 2);
+  storage_unmount();
+
+  // a clean mount loads the saved totals.
+  storage_mount(TEST_NAME, NULL);
+  check_usage("/d", DIRENT_SIZE + 4096, 2, 2);
+  CHECK(0 == storage_truncate("/d/g", 0));
+  // leaves the image dirty, without saving the totals.
+  blocks_free();
+
+  // an unclean mount adds them up again.
+  storage_mount(TEST_NAME, NULL);
+  check_usage("/d", DIRENT_SIZE, 1, 2);
+  storage_unmount();
+
+  unlink(TEST_NAME);
+  fprintf(stderr, "usage_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,71 @@
+// Reads files from several threads at once through a windowed mapping
+// with few windows, so readers keep evicting each other's windows.
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "blocks.h"
+#include "storage.h"
+
+#include "check.h"
+
+#define TEST_NAME "window_test.img"
+#define FILES 8
+#define FILE_SIZE (14 * 4096 + 123) // uses the indirect block
+#define THREADS 4
+#define ROUNDS 200
+
+// Gets the byte stored at the given offset of the given file.
+static char file_byte(int file, int offset) {
+  return 'a' + (file * 7 + offset) % 26;
+}
+
+// Reads every file over and over, checking what comes back.
+static void *reader(void *arg) {
+  static char bufs[THREADS][FILE_SIZE];
+  int id = (int) (long) arg;
+  char *buf = bufs[id];
+  char path[16];
+  for (int round = 0; round < ROUNDS; ++round) {
+    int file = (id + round) % FILES;
+    snprintf(path, sizeof(path), "/f%d", file);
+    CHECK(FILE_SIZE == storage_read(path, buf, FILE_SIZE, 0));
+    for (int ii = 0; ii < FILE_SIZE; ++ii) {
+      CHECK(file_byte(file, ii) == buf[ii]);
+    }
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  unlink(TEST_NAME);
+  // windows just big enough for the metadata, and as few of them as
+  // are allowed.
+  blocks_opts_t opts = {.window_blocks = 1, .max_windows = 1};
+  storage_mount(TEST_NAME, &opts);
+
+  static char data[FILE_SIZE];
+  char path[16];
+  for (int file = 0; file < FILES; ++file) {
+    for (int ii = 0; ii < FILE_SIZE; ++ii) {
+      data[ii] = file_byte(file, ii);
+    }
+    snprintf(path, sizeof(path), "/f%d", file);
+    CHECK(0 == storage_mknod(path, 0100644));
+    CHECK(FILE_SIZE == storage_write(path, data, FILE_SIZE, 0));
+  }
+
+  pthread_t threads[THREADS];
+  for (int ii = 0; ii < THREADS; ++ii) {
+    CHECK(0 == pthread_create(&threads[ii], NULL, reader, (void *) (long) ii));
+  }
+  for (int ii = 0; ii < THREADS; ++ii) {
+    pthread_join(threads[ii], NULL);
+  }
+
+  storage_unmount();
+  unlink(TEST_NAME);
+  fprintf(stderr, "window_test: ok\n");
+  return 0;
+}
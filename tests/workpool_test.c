@@ -0,0 +1,119 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "workpool.h"
+
+#include "check.h"
+
+#define TASKS 20000
+#define STOLEN 64   // tasks a blocked worker queues for the others
+#define DELAYED 8   // tasks run after a delay
+#define DELAY 20000000 // 20ms, in nanoseconds
+#define MAX_PENDING 4
+
+static workpool_t *pool;
+static long total = 0;
+
+static void add(void *arg) {
+  __atomic_add_fetch(&total, (long) arg, __ATOMIC_RELAXED);
+}
+
+// submits more tasks from a worker, which must not wait on a full pool.
+static void spawn(void *arg) {
+  for (long i = 0; i < 10; i++) {
+    workpool_submit(pool, add, (void *) 1);
+  }
+  add(arg);
+}
+
+static pthread_t hog_thread;
+static int stolen = 0;
+static int stolen_by_hog = 0;
+
+// Counts a task queued by the hog, and who ran it.
+static void count_stolen(void *arg) {
+  if (pthread_equal(pthread_self(), hog_thread)) {
+    __atomic_add_fetch(&stolen_by_hog, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_add_fetch(&stolen, 1, __ATOMIC_RELAXED);
+}
+
+// Queues tasks on its own worker's queue and then waits for them
+// without running any, so the other workers must steal every one.
+static void hog(void *arg) {
+  hog_thread = pthread_self();
+  for (int i = 0; i < STOLEN; i++) {
+    workpool_submit(pool, count_stolen, NULL);
+  }
+  for (int i = 0; i < 500 && STOLEN != __atomic_load_n(&stolen, __ATOMIC_RELAXED); i++) {
+    usleep(10000);
+  }
+}
+
+static int delayed = 0;
+static int early = 0;
+
+// Counts a delayed task, and whether it ran before it was due.
+static void count_delayed(void *arg) {
+  if (workpool_now() < (uint64_t) arg) {
+    __atomic_add_fetch(&early, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_add_fetch(&delayed, 1, __ATOMIC_RELAXED);
+}
+
+static int finished = 0;
+
+// Takes a while, so the pool fills up behind it.
+static void slow(void *arg) {
+  usleep(1000);
+  __atomic_add_fetch(&finished, 1, __ATOMIC_SEQ_CST);
+}
+
+int main(int argc, char **argv) {
+  // runs every task, including ones queued by workers on a full pool.
+  pool = workpool_new(4, 8, 0);
+  CHECK(NULL != pool);
+  for (long i = 1; i <= TASKS; i++) {
+    CHECK(0 == workpool_submit(pool, i % 100 == 0 ? spawn : add, (void *) i));
+  }
+  workpool_free(pool);
+  long expected = (long) TASKS * (TASKS + 1) / 2 + TASKS / 100 * 10;
+  CHECK(expected == total);
+
+  // idle workers steal the tasks queued by a busy one.
+  pool = workpool_new(4, STOLEN * 2, 0);
+  CHECK(0 == workpool_submit(pool, hog, NULL));
+  workpool_free(pool);
+  CHECK(STOLEN == stolen);
+  CHECK(0 == stolen_by_hog);
+
+  // delayed tasks run once due, and the rest when the pool is freed.
+  pool = workpool_new(2, 2, 0);
+  uint64_t when = workpool_now() + DELAY;
+  for (int i = 0; i < DELAYED; i++) {
+    CHECK(0 == workpool_submit_at(pool, i % WORKPOOL_PRIORITIES, when, count_delayed,
+                                  (void *) when));
+  }
+  uint64_t late = workpool_now() + 3600ull * 1000000000;
+  CHECK(0 == workpool_submit_at(pool, 0, late, count_delayed, (void *) 0));
+  for (int i = 0; i < 100 && DELAYED != __atomic_load_n(&delayed, __ATOMIC_RELAXED); i++) {
+    usleep(10000);
+  }
+  CHECK(DELAYED == __atomic_load_n(&delayed, __ATOMIC_RELAXED));
+  workpool_free(pool);
+  CHECK(DELAYED + 1 == delayed);
+  CHECK(0 == early);
+
+  // submitting waits while the pool holds max_pending tasks.
+  pool = workpool_new(2, MAX_PENDING, 0);
+  for (int i = 1; i <= 50; i++) {
+    CHECK(0 == workpool_submit(pool, slow, NULL));
+    CHECK(i - __atomic_load_n(&finished, __ATOMIC_SEQ_CST) <= MAX_PENDING);
+  }
+  workpool_free(pool);
+  CHECK(50 == finished);
+
+  fprintf(stderr, "workpool_test: ok\n");
+  return 0;
+}
@@ -0,0 +1,215 @@
+/**
+ * @file nufs_cbt.c
+ *
+ * Offline incremental backups of a nufs image using its changed-block
+ * tracking. Run it on an image that is not mounted:
+ *
+ *   nufs-cbt epoch IMAGE              prints the image's current epoch
+ *   nufs-cbt export IMAGE SINCE DELTA writes the blocks changed in epoch
+ *                                     SINCE or later to the file DELTA
+ *   nufs-cbt apply IMAGE DELTA        writes the blocks in DELTA to IMAGE
+ *
+ * apply refuses images that are mounted, and, unless DELTA is a full
+ * backup, images not at the epoch before SINCE. It reads all of DELTA
+ * before writing anything, so a damaged delta leaves IMAGE as it was.
+ *
+ * A full backup is an export since epoch 1. export prints the epoch to
+ * pass as SINCE for the next backup. Restoring applies the deltas, in
+ * order, to a copy of the image the first one was taken from.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bitmap.h"
+#include "blocks.h"
+#include "cbt.h"
+#include "super.h"
+
+#define CBT_DELTA_MAGIC 0x5442434e // "NCBT" in little endian
+#define CBT_DELTA_FREE 0x80000000u // block number flag: free, reads as zeros
+
+// Header of a delta file, followed by count records of a block number
+// and the block's contents. Free blocks have no contents.
+typedef struct cbt_delta_t {
+  uint32_t magic;      // CBT_DELTA_MAGIC
+  uint32_t block_size; // BLOCK_SIZE of the image
+  uint32_t since;      // first epoch included
+  uint32_t epoch;      // epoch of the image when exported
+  uint32_t count;      // number of blocks
+} cbt_delta_t;
+
+// Maps an existing image, without creating one by mistake.
+static int cbt_open(const char *image) {
+  if (0 != access(image, R_OK | W_OK)) {
+    perror(image);
+    return -1;
+  }
+  blocks_init(image);
+  return 0;
+}
+
+// Writes the blocks of the mapped image changed since the given epoch
+// to a delta file.
+static int cbt_write_delta(const char *image, uint32_t since, const char *path) {
+  super_t *sb = get_super();
+  uint32_t *epochs = cbt_epochs();
+  if (SUPER_MAGIC != sb->magic || NULL == epochs) {
+    fprintf(stderr, "%s: does not track changed blocks\n", image);
+    return 1;
+  }
+  // a mounted image is still changing, and one that crashed may have
+  // lost changes it had recorded; mounting it again marks all blocks.
+  if (SUPER_CLEAN != sb->state) {
+    fprintf(stderr, "%s: mounted or not unmounted cleanly\n", image);
+    return 1;
+  }
+  FILE *out = fopen(path, "w");
+  if (NULL == out) {
+    perror(path);
+    return 1;
+  }
+  cbt_delta_t delta = {CBT_DELTA_MAGIC, BLOCK_SIZE, since, sb->cbt_epoch, 0};
+  for (int ii = 0; ii < BLOCK_COUNT; ++ii) {
+    delta.count += since <= epochs[ii];
+  }
+  fwrite(&delta, sizeof(delta), 1, out);
+  void *bbm = get_blocks_bitmap();
+  for (uint32_t ii = 0; ii < (uint32_t) BLOCK_COUNT; ++ii) {
+    if (since > epochs[ii]) {
+      continue;
+    }
+    if (!bitmap_get(bbm, ii)) {
+      uint32_t bnum = ii | CBT_DELTA_FREE;
+      fwrite(&bnum, sizeof(bnum), 1, out);
+    } else {
+      fwrite(&ii, sizeof(ii), 1, out);
+      fwrite(blocks_get_block(ii), BLOCK_SIZE, 1, out);
+    }
+  }
+  int rv = fclose(out);
+  if (0 != rv) {
+    perror(path);
+    return 1;
+  }
+  fprintf(stderr, "%u of %d blocks; next backup since epoch %u\n",
+          delta.count, BLOCK_COUNT, delta.epoch + 1);
+  return 0;
+}
+
+// Writes the blocks changed since the given epoch to a delta file.
+static int cbt_export(const char *image, uint32_t since, const char *path) {
+  if (-1 == cbt_open(image)) {
+    return 1;
+  }
+  int rv = cbt_write_delta(image, since, path);
+  blocks_free();
+  return rv;
+}
+
+// Reads a whole delta file into memory, so a truncated or corrupt one
+// is found before anything is written. Fills in the header, the block
+// numbers and their contents, at BLOCK_SIZE apart. Returns 0 on
+// success or -1.
+static int cbt_read_delta(const char *path, cbt_delta_t *delta, uint32_t *bnums,
+                          char *blocks) {
+  FILE *in = fopen(path, "r");
+  if (NULL == in) {
+    perror(path);
+    return -1;
+  }
+  int ok = 1 == fread(delta, sizeof(*delta), 1, in) &&
+           CBT_DELTA_MAGIC == delta->magic &&
+           (uint32_t) BLOCK_SIZE == delta->block_size &&
+           (uint32_t) BLOCK_COUNT >= delta->count;
+  if (!ok) {
+    fprintf(stderr, "%s: not a delta of this image format\n", path);
+    fclose(in);
+    return -1;
+  }
+  for (uint32_t ii = 0; ok && ii < delta->count; ++ii) {
+    ok = 1 == fread(&bnums[ii], sizeof(bnums[ii]), 1, in) &&
+         (uint32_t) BLOCK_COUNT > (bnums[ii] & ~CBT_DELTA_FREE);
+    if (ok && !(bnums[ii] & CBT_DELTA_FREE)) {
+      ok = 1 == fread(blocks + (size_t) BLOCK_SIZE * ii, BLOCK_SIZE, 1, in);
+    }
+    if (!ok) {
+      fprintf(stderr, "%s: truncated or corrupt after %u blocks\n", path, ii);
+    }
+  }
+  // anything after the last block means the count is wrong.
+  if (ok && EOF != fgetc(in)) {
+    fprintf(stderr, "%s: data after the last block\n", path);
+    ok = 0;
+  }
+  fclose(in);
+  return ok ? 0 : -1;
+}
+
+// Checks that a delta may be applied to the mapped image: it must not
+// be mounted, and unless the delta is a full backup, the image must be
+// at the epoch before the first one in the delta.
+static int cbt_check_base(const char *image, const cbt_delta_t *delta) {
+  super_t *sb = get_super();
+  int formatted = SUPER_MAGIC == sb->magic;
+  if (formatted && SUPER_CLEAN != sb->state) {
+    fprintf(stderr, "%s: mounted or not unmounted cleanly\n", image);
+    return -1;
+  }
+  if (1 < delta->since && (!formatted || sb->cbt_epoch + 1 != delta->since)) {
+    fprintf(stderr, "%s: at epoch %u, but the delta applies to epoch %u\n",
+            image, formatted ? sb->cbt_epoch : 0, delta->since - 1);
+    return -1;
+  }
+  return 0;
+}
+
+// Writes the blocks of a delta file to an image.
+static int cbt_apply(const char *image, const char *path) {
+  cbt_delta_t delta;
+  uint32_t *bnums = calloc(BLOCK_COUNT, sizeof(uint32_t));
+  char *blocks = malloc((size_t) BLOCK_SIZE * BLOCK_COUNT);
+  int rv = 1;
+  if (NULL != bnums && NULL != blocks &&
+      0 == cbt_read_delta(path, &delta, bnums, blocks) && 0 == cbt_open(image)) {
+    if (0 == cbt_check_base(image, &delta)) {
+      for (uint32_t ii = 0; ii < delta.count; ++ii) {
+        void *block = blocks_get_block(bnums[ii] & ~CBT_DELTA_FREE);
+        if (bnums[ii] & CBT_DELTA_FREE) {
+          memset(block, 0, BLOCK_SIZE);
+        } else {
+          memcpy(block, blocks + (size_t) BLOCK_SIZE * ii, BLOCK_SIZE);
+        }
+      }
+      fprintf(stderr, "%u blocks; image at epoch %u\n", delta.count, delta.epoch);
+      rv = 0;
+    }
+    blocks_free();
+  }
+  free(bnums);
+  free(blocks);
+  return rv;
+}
+
+int main(int argc, char **argv) {
+  if (3 == argc && 0 == strcmp(argv[1], "epoch")) {
+    if (-1 == cbt_open(argv[2])) {
+      return 1;
+    }
+    printf("%u\n", get_super()->cbt_epoch);
+    blocks_free();
+    return 0;
+  }
+  if (5 == argc && 0 == strcmp(argv[1], "export")) {
+    return cbt_export(argv[2], strtoul(argv[3], NULL, 10), argv[4]);
+  }
+  if (4 == argc && 0 == strcmp(argv[1], "apply")) {
+    return cbt_apply(argv[2], argv[3]);
+  }
+  fprintf(stderr, "usage: %s epoch IMAGE\n"
+                  "       %s export IMAGE SINCE DELTA\n"
+                  "       %s apply IMAGE DELTA\n", argv[0], argv[0], argv[0]);
+  return 2;
+}
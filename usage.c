@@ -0,0 +1,113 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitmap.h"
+#include "blocks.h"
+#include "cbt.h"
+#include "inode.h"
+#include "super.h"
+#include "usage.h"
+
+// usage totals, one per inode. Only changed with the file system
+// locked for writing.
+static usage_t *usage = NULL;
+
+// Adds the given usage to the directories from the given inode up.
+// NOTE: Stops after INODE_COUNT steps, in case of a cycle.
+static void usage_propagate(inode_t *node, int bytes, int blocks, int inodes) {
+  for (int ii = 0; ii < INODE_COUNT && inode_valid(node); ++ii) {
+    usage_t *u = &usage[node->inum];
+    u->bytes += bytes;
+    u->blocks += blocks;
+    u->inodes += inodes;
+    node = get_inode(node->parent);
+  }
+}
+
+// Checks the superblock records an allocated block for the totals.
+static int usage_block_valid(super_t *sb) {
+  return 0 < sb->usage_block && sb->usage_block < BLOCK_COUNT &&
+         bitmap_get(get_blocks_bitmap(), sb->usage_block);
+}
+
+// Starts tracking usage, from the saved totals if they can be trusted.
+void usage_init(int clean) {
+  assert(INODE_COUNT * sizeof(usage_t) <= (size_t) BLOCK_SIZE);
+  super_t *sb = get_super();
+  usage = calloc(INODE_COUNT, sizeof(usage_t));
+  if (clean && sb->usage_saved && usage_block_valid(sb)) {
+    memcpy(usage, blocks_get_block(sb->usage_block), INODE_COUNT * sizeof(usage_t));
+    printf("+ usage_init() -> loaded\n");
+  } else {
+    // adds every inode to itself and the directories above it.
+    int count = 0;
+    for (int inum = inode_next(0); -1 != inum; inum = inode_next(inum + 1)) {
+      inode_t *node = get_inode(inum);
+      if (NULL != node) {
+        usage_propagate(node, node->size, bytes_to_blocks(node->size), 1);
+        ++count;
+      }
+    }
+    printf("+ usage_init() -> counted %d inodes\n", count);
+  }
+  // the saved totals go stale as soon as anything changes.
+  sb->usage_saved = 0;
+}
+
+// Adds to the usage of an inode and the directories above it.
+void usage_add(inode_t *node, int bytes, int blocks, int inodes) {
+  if (NULL == usage) {
+    return;
+  }
+  usage_propagate(node, bytes, blocks, inodes);
+}
+
+// Adds an inode's usage to the directories above it.
+void usage_attach(inode_t *node) {
+  if (NULL == usage || !inode_valid(node)) {
+    return;
+  }
+  usage_t u = usage[node->inum];
+  usage_propagate(get_inode(node->parent), u.bytes, u.blocks, u.inodes);
+}
+
+// Takes an inode's usage away from the directories above it.
+void usage_detach(inode_t *node) {
+  if (NULL == usage || !inode_valid(node)) {
+    return;
+  }
+  usage_t u = usage[node->inum];
+  usage_propagate(get_inode(node->parent), -u.bytes, -u.blocks, -u.inodes);
+}
+
+// Gets the usage of an inode and what is under it.
+int usage_get(inode_t *node, usage_t *u) {
+  if (NULL == usage || !inode_valid(node)) {
+    return -1;
+  }
+  *u = usage[node->inum];
+  return 0;
+}
+
+// Saves the totals for the next mount.
+void usage_save(void) {
+  if (NULL == usage) {
+    return;
+  }
+  super_t *sb = get_super();
+  if (!usage_block_valid(sb)) {
+    sb->usage_block = alloc_block();
+  }
+  if (-1 == sb->usage_block) {
+    // the totals are added up again on the next mount.
+    sb->usage_block = 0;
+    printf("+ usage_save() -> -1\n");
+    return;
+  }
+  memcpy(blocks_get_block(sb->usage_block), usage, INODE_COUNT * sizeof(usage_t));
+  cbt_mark(sb->usage_block);
+  sb->usage_saved = 1;
+  printf("+ usage_save() -> %d\n", sb->usage_block);
+}
@@ -0,0 +1,68 @@
+// Recursive space and inode usage of every directory's subtree, kept
+// up to date as files change so it never has to be summed up.
+#ifndef USAGE_H
+#define USAGE_H
+
+#include "inode.h"
+
+// Usage of an inode and, for a directory, everything under it.
+typedef struct usage_t {
+  int bytes;  // file sizes
+  int blocks; // data blocks of the file sizes
+  int inodes; // number of inodes
+} usage_t;
+
+/**
+ * Starts tracking usage. Loads the totals saved by usage_save on the
+ * last unmount if it was clean, or adds them up from the inode table
+ * and parent pointers otherwise.
+ *
+ * @param clean 1 if the file system was unmounted cleanly.
+ */
+void usage_init(int clean);
+
+/**
+ * Adds to the usage of an inode and of all the directories above it.
+ *
+ * @param node Inode.
+ * @param bytes Change in bytes.
+ * @param blocks Change in blocks.
+ * @param inodes Change in inodes.
+ */
+void usage_add(inode_t *node, int bytes, int blocks, int inodes);
+
+/**
+ * Adds the usage of an inode and what is under it to the directories
+ * above it, once it has been given a parent.
+ *
+ * @param node Inode.
+ */
+void usage_attach(inode_t *node);
+
+/**
+ * Takes the usage of an inode and what is under it away from the
+ * directories above it, before its parent is changed or cleared.
+ *
+ * @param node Inode.
+ */
+void usage_detach(inode_t *node);
+
+/**
+ * Gets the usage of an inode and, for a directory, everything under it.
+ * Hard linked files count under the directory they were last linked
+ * into.
+ *
+ * @param node Inode.
+ * @param usage Usage to fill in.
+ *
+ * @return 0 on success, or -1 if the inode is invalid.
+ */
+int usage_get(inode_t *node, usage_t *usage);
+
+/**
+ * Saves the totals to a block recorded in the superblock, to be loaded
+ * on the next mount if this one ends cleanly.
+ */
+void usage_save(void);
+
+#endif
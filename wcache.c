@@ -0,0 +1,192 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inode.h"
+#include "wcache.h"
+#include "workpool.h"
+
+// Buffered writes of an inode, shared by its open files.
+typedef struct wcache_buf_t {
+  pthread_mutex_t lock;
+  int opens;      // open files of the inode (guarded by wcache_lock)
+  off_t offset;   // file offset of the buffered data
+  size_t len;     // number of bytes buffered
+  uint64_t since; // time the buffer was first written to, from workpool_now
+  int error;      // error from a background flush not yet reported
+  char data[WCACHE_SIZE];
+} wcache_buf_t;
+
+static wcache_apply_fn wcache_apply = NULL;
+// guards the table of buffers, one slot per inode.
+static pthread_mutex_t wcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static wcache_buf_t **wcache_bufs = NULL;
+static int wcache_dirty_count = 0; // buffers holding data
+
+// Enables write combining for files opened from now on.
+void wcache_init(wcache_apply_fn apply) {
+  wcache_apply = apply;
+  wcache_bufs = calloc(INODE_COUNT, sizeof(wcache_buf_t *));
+  printf("+ wcache_init()\n");
+}
+
+// Gets and locks the buffer of the given inode, or NULL if it has none.
+// The buffer is locked before the table is unlocked, so it can not be
+// dropped in between.
+static wcache_buf_t *wcache_lock_buf(int inum) {
+  if (NULL == wcache_bufs || inum <= 0 || INODE_COUNT <= inum) {
+    return NULL;
+  }
+  pthread_mutex_lock(&wcache_lock);
+  wcache_buf_t *wb = wcache_bufs[inum];
+  if (NULL != wb) {
+    pthread_mutex_lock(&wb->lock);
+  }
+  pthread_mutex_unlock(&wcache_lock);
+  return wb;
+}
+
+// Writes out the given buffer.
+// NOTE: the buffer's lock must be held.
+static int wcache_flush_locked(int inum, wcache_buf_t *wb) {
+  if (0 == wb->len) {
+    return 0;
+  }
+  int rv = wcache_apply(inum, wb->data, wb->len, wb->offset);
+  if (0 <= rv && (size_t) rv < wb->len) {
+    rv = -ENOSPC;
+  }
+  wb->len = 0;
+  __atomic_sub_fetch(&wcache_dirty_count, 1, __ATOMIC_RELAXED);
+  return rv < 0 ? rv : 0;
+}
+
+// Sets up the buffer for an inode being opened.
+void wcache_open(int inum) {
+  if (NULL == wcache_bufs || inum <= 0 || INODE_COUNT <= inum) {
+    return;
+  }
+  pthread_mutex_lock(&wcache_lock);
+  wcache_buf_t *wb = wcache_bufs[inum];
+  if (NULL == wb) {
+    wb = calloc(1, sizeof(wcache_buf_t));
+    pthread_mutex_init(&wb->lock, NULL);
+    wcache_bufs[inum] = wb;
+  }
+  ++wb->opens;
+  pthread_mutex_unlock(&wcache_lock);
+}
+
+// Writes out the inode's buffer, dropping it with the last open file.
+int wcache_release(int inum) {
+  int rv = wcache_flush(inum);
+  if (NULL == wcache_bufs || inum <= 0 || INODE_COUNT <= inum) {
+    return rv;
+  }
+  pthread_mutex_lock(&wcache_lock);
+  wcache_buf_t *wb = wcache_bufs[inum];
+  if (NULL != wb && 0 == --wb->opens) {
+    wcache_bufs[inum] = NULL;
+  } else {
+    wb = NULL;
+  }
+  pthread_mutex_unlock(&wcache_lock);
+  if (NULL != wb) {
+    // waits out anyone who locked the buffer before it left the table.
+    pthread_mutex_lock(&wb->lock);
+    wcache_flush_locked(inum, wb);
+    pthread_mutex_unlock(&wb->lock);
+    pthread_mutex_destroy(&wb->lock);
+    free(wb);
+  }
+  return rv;
+}
+
+// Buffers a small write that continues the buffered data.
+int wcache_write(int inum, const char *buf, size_t size, off_t offset) {
+  wcache_buf_t *wb = wcache_lock_buf(inum);
+  if (NULL == wb) {
+    return 0;
+  }
+  int rv = wb->error;
+  wb->error = 0;
+  // writes out what does not line up with this write.
+  if (0 < wb->len && (offset != wb->offset + (off_t) wb->len ||
+                      WCACHE_MAX_WRITE < size || WCACHE_SIZE < wb->len + size)) {
+    int err = wcache_flush_locked(inum, wb);
+    rv = 0 == rv ? err : rv;
+  }
+  if (0 == rv && size <= WCACHE_MAX_WRITE) {
+    if (0 == wb->len) {
+      wb->offset = offset;
+      wb->since = workpool_now();
+      __atomic_add_fetch(&wcache_dirty_count, 1, __ATOMIC_RELAXED);
+    }
+    memcpy(wb->data + wb->len, buf, size);
+    wb->len += size;
+    rv = size;
+    if (WCACHE_SIZE <= wb->len) {
+      int err = wcache_flush_locked(inum, wb);
+      rv = 0 == err ? rv : err;
+    }
+  }
+  pthread_mutex_unlock(&wb->lock);
+  return rv;
+}
+
+// Writes out the buffered data of an inode.
+int wcache_flush(int inum) {
+  wcache_buf_t *wb = wcache_lock_buf(inum);
+  if (NULL == wb) {
+    return 0;
+  }
+  int rv = wb->error;
+  wb->error = 0;
+  int err = wcache_flush_locked(inum, wb);
+  pthread_mutex_unlock(&wb->lock);
+  return 0 == rv ? err : rv;
+}
+
+// Checks if any inode has buffered data.
+int wcache_dirty() {
+  return 0 < __atomic_load_n(&wcache_dirty_count, __ATOMIC_RELAXED);
+}
+
+// Writes out the buffers that are older than the given time, keeping
+// errors to report to the next caller. Returns the last error.
+static int wcache_flush_older(uint64_t before) {
+  int rv = 0;
+  if (NULL == wcache_bufs || !wcache_dirty()) {
+    return 0;
+  }
+  for (int inum = 1; inum < INODE_COUNT; ++inum) {
+    wcache_buf_t *wb = wcache_lock_buf(inum);
+    if (NULL == wb) {
+      continue;
+    }
+    if (0 < wb->len && wb->since <= before) {
+      int err = wcache_flush_locked(inum, wb);
+      if (0 != err) {
+        wb->error = err;
+        rv = err;
+      }
+    }
+    pthread_mutex_unlock(&wb->lock);
+  }
+  return rv;
+}
+
+// Writes out every buffer.
+int wcache_flush_all() {
+  return wcache_flush_older(UINT64_MAX);
+}
+
+// Writes out buffers held longer than 1 / WCACHE_FLUSH_HZ seconds.
+int wcache_timer_step(void *arg) {
+  (void) arg;
+  wcache_flush_older(workpool_now() - 1000000000 / WCACHE_FLUSH_HZ);
+  return 1;
+}
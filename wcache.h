@@ -0,0 +1,93 @@
+// Write-combining buffers for small sequential writes to open files.
+#ifndef WCACHE_H
+#define WCACHE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define WCACHE_SIZE (64 * 1024) // bytes combined before they are written out
+#define WCACHE_MAX_WRITE 4096   // larger writes bypass the buffer
+#define WCACHE_FLUSH_HZ 20      // buffers are written out after 1/HZ seconds
+
+/**
+ * Writes combined data to an inode. Called with no wcache locks but
+ * the buffer's own held.
+ *
+ * @return Number of bytes written, or a negative error.
+ */
+typedef int (*wcache_apply_fn)(int inum, const char *buf, size_t size, off_t offset);
+
+/**
+ * Enables write combining for files opened from now on.
+ *
+ * @param apply Function writing combined data to an inode.
+ */
+void wcache_init(wcache_apply_fn apply);
+
+/**
+ * Sets up the buffer for an inode being opened. Every open file of an
+ * inode shares its buffer, so writes stay in order across them.
+ *
+ * @param inum Inode number.
+ */
+void wcache_open(int inum);
+
+/**
+ * Writes out and, once the inode's last open file is released, drops
+ * its buffer.
+ *
+ * @param inum Inode number.
+ *
+ * @return 0 on success, or the negative error of writing out the buffer.
+ */
+int wcache_release(int inum);
+
+/**
+ * Buffers a small write if it continues the buffered data, writing out
+ * the buffer first otherwise and whenever it fills up.
+ *
+ * @param inum Inode number.
+ * @param buf Data to write.
+ * @param size Number of bytes to write.
+ * @param offset File offset to write at.
+ *
+ * @return size if the write was buffered, 0 if the caller must write
+ *         the data itself (any buffered data has been written out), or
+ *         a negative error from writing out earlier buffered data.
+ */
+int wcache_write(int inum, const char *buf, size_t size, off_t offset);
+
+/**
+ * Writes out the buffered data of an inode, if any.
+ *
+ * @param inum Inode number.
+ *
+ * @return 0 on success, or a negative error. An error from writing out
+ *         the buffer in the background is returned here once.
+ */
+int wcache_flush(int inum);
+
+/**
+ * Checks if any inode has buffered data, so callers can skip looking
+ * up an inode to flush.
+ *
+ * @return 1 if there is buffered data, 0 otherwise.
+ */
+int wcache_dirty(void);
+
+/**
+ * Writes out every buffer. Returns 0 on success, or the last error.
+ */
+int wcache_flush_all(void);
+
+/**
+ * Background step writing out buffers that have been held longer than
+ * 1 / WCACHE_FLUSH_HZ seconds. Always returns 1, to be run with a rate
+ * of WCACHE_FLUSH_HZ steps per second. A flush holds the file system
+ * lock exclusively, so it is meant to run as a BGSCHED_PROMPT task.
+ *
+ * @param arg Unused.
+ */
+int wcache_timer_step(void *arg);
+
+#endif
@@ -0,0 +1,374 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "workpool.h"
+
+// A queued task.
+typedef struct workpool_task_t {
+  workpool_fn fn;
+  void *arg;
+  uint64_t when; // earliest time to run, for delayed tasks
+  int priority;
+  struct workpool_task_t *next;
+} workpool_task_t;
+
+// A worker's own task queue for one priority, which other workers may
+// steal from.
+typedef struct workpool_queue_t {
+  pthread_mutex_t lock;
+  workpool_task_t *head; // the owner takes tasks from the head
+  workpool_task_t *tail;
+  int length;
+} workpool_queue_t;
+
+// A worker thread.
+typedef struct workpool_worker_t {
+  pthread_t thread;
+  int idx;
+  int cpu; // CPU to run on, or -1 for any
+  workpool_t *pool;
+} workpool_worker_t;
+
+struct workpool_t {
+  int threads;
+  int started; // workers actually running
+  workpool_queue_t *queues; // WORKPOOL_PRIORITIES queues per worker
+  workpool_worker_t *workers;
+  unsigned int next_queue; // round robin queue for outside submissions
+  int max_pending;
+  int flags;
+
+  // the counters are updated atomically; the lock and conditions are
+  // only used to sleep when there is no work or no room, and to guard
+  // the delayed tasks.
+  int queued;  // tasks waiting in queues
+  int pending; // tasks queued or running, including delayed ones now due
+  int idle;    // workers asleep or about to sleep
+  int waiting; // submitters asleep or about to sleep
+  int stop;
+  workpool_task_t *delayed; // tasks not yet due, soonest first
+  uint64_t next_due;        // time the first delayed task is due, or 0
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t room;
+};
+
+// the worker running on this thread, if any.
+static __thread workpool_worker_t *workpool_self = NULL;
+
+// Gets the current monotonic time in nanoseconds.
+uint64_t workpool_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Gets the queue of the given worker for the given priority.
+static workpool_queue_t *workpool_queue(workpool_t *pool, int idx, int priority) {
+  return &pool->queues[idx * WORKPOOL_PRIORITIES + priority];
+}
+
+// Appends a task to the tail of the given queue.
+static void workpool_push(workpool_queue_t *q, workpool_task_t *task) {
+  pthread_mutex_lock(&q->lock);
+  task->next = NULL;
+  if (NULL == q->tail) {
+    q->head = task;
+  } else {
+    q->tail->next = task;
+  }
+  q->tail = task;
+  __atomic_store_n(&q->length, q->length + 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&q->lock);
+}
+
+// Takes the task at the head of the given queue, or NULL if empty.
+static workpool_task_t *workpool_pop(workpool_queue_t *q) {
+  if (0 == __atomic_load_n(&q->length, __ATOMIC_RELAXED)) {
+    return NULL;
+  }
+  pthread_mutex_lock(&q->lock);
+  workpool_task_t *task = q->head;
+  if (NULL != task) {
+    q->head = task->next;
+    if (NULL == q->head) {
+      q->tail = NULL;
+    }
+    __atomic_store_n(&q->length, q->length - 1, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return task;
+}
+
+// Takes the highest priority task from the worker's own queues, or
+// steals one from the other workers, starting with the next one over.
+static workpool_task_t *workpool_take(workpool_t *pool, int idx) {
+  for (int prio = 0; prio < WORKPOOL_PRIORITIES; ++prio) {
+    for (int ii = 0; ii < pool->threads; ++ii) {
+      workpool_queue_t *q = workpool_queue(pool, (idx + ii) % pool->threads, prio);
+      workpool_task_t *task = workpool_pop(q);
+      if (NULL != task) {
+        __atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+        return task;
+      }
+    }
+  }
+  return NULL;
+}
+
+// Moves the delayed tasks that are due, or all of them if the pool is
+// stopping, onto the given worker's queues.
+// NOTE: the pool lock must be held.
+static void workpool_release_due(workpool_t *pool, int idx) {
+  uint64_t now = workpool_now();
+  workpool_task_t *task;
+  while (NULL != (task = pool->delayed) && (pool->stop || task->when <= now)) {
+    pool->delayed = task->next;
+    __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+    workpool_push(workpool_queue(pool, idx, task->priority), task);
+    __atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+  }
+  __atomic_store_n(&pool->next_due, NULL == task ? 0 : task->when, __ATOMIC_RELAXED);
+}
+
+// Sleeps until there is queued work or the pool stops, waking up to
+// queue delayed tasks when they are due.
+// NOTE: the pool lock must be held.
+static void workpool_wait(workpool_t *pool, int idx) {
+  for (;;) {
+    workpool_release_due(pool, idx);
+    if (0 < __atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) || pool->stop) {
+      return;
+    }
+    if (NULL == pool->delayed) {
+      pthread_cond_wait(&pool->work, &pool->lock);
+    } else {
+      struct timespec ts;
+      ts.tv_sec = pool->delayed->when / 1000000000;
+      ts.tv_nsec = pool->delayed->when % 1000000000;
+      pthread_cond_timedwait(&pool->work, &pool->lock, &ts);
+    }
+  }
+}
+
+// Runs tasks until the pool stops and no tasks are left.
+static void *workpool_worker(void *arg) {
+  workpool_worker_t *self = arg;
+  workpool_t *pool = self->pool;
+  workpool_self = self;
+
+  if (pool->flags & WORKPOOL_BACKGROUND) {
+    struct sched_param param = { 0 };
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+  }
+  if (-1 != self->cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(self->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  }
+
+  for (;;) {
+    // queues delayed tasks that came due while the workers were busy.
+    uint64_t due = __atomic_load_n(&pool->next_due, __ATOMIC_RELAXED);
+    if (0 != due && due <= workpool_now()) {
+      pthread_mutex_lock(&pool->lock);
+      workpool_release_due(pool, self->idx);
+      pthread_mutex_unlock(&pool->lock);
+    }
+
+    workpool_task_t *task = workpool_take(pool, self->idx);
+    if (NULL == task) {
+      // announces going idle before checking for work one last time,
+      // so a submitter either sees this worker idle or it sees the task.
+      pthread_mutex_lock(&pool->lock);
+      __atomic_add_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+      workpool_wait(pool, self->idx);
+      __atomic_sub_fetch(&pool->idle, 1, __ATOMIC_SEQ_CST);
+      int done = pool->stop && 0 == __atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST);
+      pthread_mutex_unlock(&pool->lock);
+      if (done) {
+        break;
+      }
+      continue;
+    }
+
+    task->fn(task->arg);
+    free(task);
+
+    // makes room for a submitter waiting on a full pool.
+    __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+    if (0 < __atomic_load_n(&pool->waiting, __ATOMIC_SEQ_CST)) {
+      pthread_mutex_lock(&pool->lock);
+      pthread_cond_signal(&pool->room);
+      pthread_mutex_unlock(&pool->lock);
+    }
+  }
+  return NULL;
+}
+
+// Starts a pool with the given number of worker threads.
+workpool_t *workpool_new(int threads, int max_pending, int flags) {
+  workpool_t *pool = calloc(1, sizeof(workpool_t));
+  pool->threads = threads < 1 ? 1 : threads;
+  pool->max_pending = max_pending < 1 ? 1 : max_pending;
+  pool->flags = flags;
+  pool->queues = calloc(pool->threads * WORKPOOL_PRIORITIES, sizeof(workpool_queue_t));
+  pool->workers = calloc(pool->threads, sizeof(workpool_worker_t));
+  pthread_mutex_init(&pool->lock, NULL);
+  // delayed tasks are timed against the monotonic clock.
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&pool->work, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_cond_init(&pool->room, NULL);
+
+  for (int ii = 0; ii < pool->threads * WORKPOOL_PRIORITIES; ++ii) {
+    pthread_mutex_init(&pool->queues[ii].lock, NULL);
+  }
+  for (int ii = 0; ii < pool->threads; ++ii) {
+    workpool_worker_t *w = &pool->workers[ii];
+    w->idx = ii;
+    w->cpu = (flags & WORKPOOL_PIN) ? workpool_cpu(ii) : -1;
+    w->pool = pool;
+    if (0 != pthread_create(&w->thread, NULL, workpool_worker, w)) {
+      perror("workpool: starting worker");
+      break;
+    }
+    ++pool->started;
+  }
+  if (pool->started < pool->threads) {
+    // workers index queues by the thread count, so the pool can not
+    // shrink to the ones that started.
+    workpool_free(pool);
+    return NULL;
+  }
+  return pool;
+}
+
+// Gets the nth CPU the calling thread may run on, or -1.
+int workpool_cpu(int nth) {
+  cpu_set_t allowed;
+  if (0 != sched_getaffinity(0, sizeof(allowed), &allowed)) {
+    return -1;
+  }
+  int count = CPU_COUNT(&allowed);
+  if (0 == count) {
+    return -1;
+  }
+  nth %= count;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &allowed) && 0 == nth--) {
+      return cpu;
+    }
+  }
+  return -1;
+}
+
+// Queues a task to run on the pool at priority 0.
+int workpool_submit(workpool_t *pool, workpool_fn fn, void *arg) {
+  return workpool_submit_at(pool, 0, 0, fn, arg);
+}
+
+// Queues a task at the given priority, to run no earlier than the
+// given time, waiting for room if the pool is full.
+int workpool_submit_at(workpool_t *pool, int priority, uint64_t when,
+                       workpool_fn fn, void *arg) {
+  // workers may still queue follow-up tasks while the pool drains.
+  int local = NULL != workpool_self && pool == workpool_self->pool;
+  if (!local && __atomic_load_n(&pool->stop, __ATOMIC_RELAXED)) {
+    return -1;
+  }
+  // reserves a slot, sleeping while the pool is full. workers never wait,
+  // since only workers make room, and delayed tasks take their slot when
+  // they come due, so they do not hold back the tasks behind them.
+  int delayed = 0 != when && workpool_now() < when;
+  while (!delayed &&
+         pool->max_pending < __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST) &&
+         !local) {
+    __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&pool->lock);
+    __atomic_add_fetch(&pool->waiting, 1, __ATOMIC_SEQ_CST);
+    while (pool->max_pending <= __atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) &&
+           !pool->stop) {
+      pthread_cond_wait(&pool->room, &pool->lock);
+    }
+    __atomic_sub_fetch(&pool->waiting, 1, __ATOMIC_SEQ_CST);
+    int stop = pool->stop;
+    pthread_mutex_unlock(&pool->lock);
+    if (stop) {
+      return -1;
+    }
+  }
+
+  workpool_task_t *task = malloc(sizeof(workpool_task_t));
+  task->fn = fn;
+  task->arg = arg;
+  task->when = when;
+  if (priority < 0) {
+    priority = 0;
+  } else if (WORKPOOL_PRIORITIES <= priority) {
+    priority = WORKPOOL_PRIORITIES - 1;
+  }
+  task->priority = priority;
+
+  if (delayed) {
+    // keeps the delayed tasks sorted by time, and wakes a worker to wait
+    // for this one in case it is the soonest.
+    pthread_mutex_lock(&pool->lock);
+    workpool_task_t **pos = &pool->delayed;
+    while (NULL != *pos && (*pos)->when <= when) {
+      pos = &(*pos)->next;
+    }
+    task->next = *pos;
+    *pos = task;
+    __atomic_store_n(&pool->next_due, pool->delayed->when, __ATOMIC_RELAXED);
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+  }
+
+  int idx;
+  if (local) {
+    idx = workpool_self->idx;
+  } else {
+    idx = __atomic_fetch_add(&pool->next_queue, 1, __ATOMIC_RELAXED) % pool->threads;
+  }
+  workpool_push(workpool_queue(pool, idx, priority), task);
+
+  // wakes a worker if any are asleep.
+  __atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+  if (0 < __atomic_load_n(&pool->idle, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return 0;
+}
+
+// Runs all queued tasks, stops the workers and frees the pool.
+void workpool_free(workpool_t *pool) {
+  pthread_mutex_lock(&pool->lock);
+  __atomic_store_n(&pool->stop, 1, __ATOMIC_RELAXED);
+  pthread_cond_broadcast(&pool->work);
+  pthread_cond_broadcast(&pool->room);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int ii = 0; ii < pool->started; ++ii) {
+    pthread_join(pool->workers[ii].thread, NULL);
+  }
+  for (int ii = 0; ii < pool->threads * WORKPOOL_PRIORITIES; ++ii) {
+    pthread_mutex_destroy(&pool->queues[ii].lock);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->work);
+  pthread_cond_destroy(&pool->room);
+  free(pool->queues);
+  free(pool->workers);
+  free(pool);
+}
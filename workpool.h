@@ -0,0 +1,87 @@
+// Work-stealing thread pool.
+#ifndef WORKPOOL_H
+#define WORKPOOL_H
+
+#include <stdint.h>
+
+#define WORKPOOL_PRIORITIES 3 // priority levels; 0 runs first
+#define WORKPOOL_BACKGROUND 1 // flag: run workers with SCHED_IDLE
+#define WORKPOOL_PIN 2        // flag: pin each worker to its own CPU
+
+// A task run by the pool.
+typedef void (*workpool_fn)(void *arg);
+
+typedef struct workpool_t workpool_t;
+
+/**
+ * Starts a pool with the given number of worker threads. Every worker
+ * has its own task queues and steals from the others when it runs dry.
+ *
+ * @param threads Number of worker threads.
+ * @param max_pending Maximum number of tasks queued or running at once;
+ *        workpool_submit blocks while the pool is this full.
+ * @param flags WORKPOOL_BACKGROUND to only run workers when the CPU
+ *        would otherwise be idle, WORKPOOL_PIN to run worker N on the
+ *        CPU given by workpool_cpu(N), or 0.
+ *
+ * @return The new pool, or NULL on failure.
+ */
+workpool_t *workpool_new(int threads, int max_pending, int flags);
+
+/**
+ * Queues a task to run on the pool at priority 0, waiting for room
+ * first if the pool already holds max_pending tasks. Tasks submitted
+ * from a worker go to that worker's own queue and never wait.
+ *
+ * @param pool Pool to run the task on.
+ * @param fn Function to run.
+ * @param arg Argument to pass to the function.
+ *
+ * @return 0 on success, -1 if the pool is shutting down and the
+ *         caller is not one of its workers.
+ */
+int workpool_submit(workpool_t *pool, workpool_fn fn, void *arg);
+
+/**
+ * Queues a task like workpool_submit, at the given priority and no
+ * earlier than the given time. Higher priority tasks that are due run
+ * before lower priority ones. A delayed task never waits for room; it
+ * only counts towards max_pending once it is due.
+ *
+ * @param pool Pool to run the task on.
+ * @param priority Priority from 0 (first) to WORKPOOL_PRIORITIES - 1.
+ * @param when Earliest time to run, from workpool_now, or 0 for now.
+ * @param fn Function to run.
+ * @param arg Argument to pass to the function.
+ *
+ * @return 0 on success, -1 if the pool is shutting down.
+ */
+int workpool_submit_at(workpool_t *pool, int priority, uint64_t when,
+                       workpool_fn fn, void *arg);
+
+/**
+ * Gets the nth CPU the calling thread may run on, wrapping around when
+ * there are fewer, so threads can be spread over the allowed CPUs.
+ *
+ * @param nth Index of the CPU among the allowed ones.
+ *
+ * @return The CPU number, or -1 if the allowed CPUs are unknown.
+ */
+int workpool_cpu(int nth);
+
+/**
+ * Gets the current time as used by workpool_submit_at.
+ *
+ * @return Monotonic time in nanoseconds.
+ */
+uint64_t workpool_now(void);
+
+/**
+ * Runs all queued tasks to completion, including delayed ones without
+ * waiting for their time, stops the workers and frees the pool.
+ *
+ * @param pool Pool to free.
+ */
+void workpool_free(workpool_t *pool);
+
+#endif